@@ -0,0 +1,65 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+
+#include "arena.hpp"
+
+Arena &Arena::peers() {
+  // Never destroyed: global objects (pending list) use it until exit
+  static Arena *arena = new Arena();
+  return *arena;
+}
+
+Arena::Arena()
+    : chunks(), cur(nullptr), end(nullptr),
+      hugePages(getenv(ARENA_HUGEPAGES_ENV) != nullptr), mut() {}
+
+void *Arena::allocate(size_t size, size_t align) {
+  std::lock_guard<std::mutex> lock(mut);
+  uintptr_t p = (reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(align - 1);
+  if (!cur || p + size > reinterpret_cast<uintptr_t>(end)) {
+    grow(size + align);
+    p = (reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(align - 1);
+  }
+  cur = reinterpret_cast<char *>(p + size);
+  return reinterpret_cast<void *>(p);
+}
+
+void Arena::grow(size_t size) {
+  // Not thread-safe!
+  size_t len = (size + ARENA_CHUNK_SIZE - 1) / ARENA_CHUNK_SIZE *
+               ARENA_CHUNK_SIZE;
+  // Over-map by one huge page to align the chunk on one
+  size_t mapped = len + ARENA_CHUNK_SIZE;
+  void *m = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m == MAP_FAILED) {
+    perror("Cannot map arena");
+    exit(EXIT_FAILURE);
+  }
+  char *raw = static_cast<char *>(m);
+  char *base = reinterpret_cast<char *>(
+      (reinterpret_cast<uintptr_t>(raw) + ARENA_CHUNK_SIZE - 1) &
+      ~(ARENA_CHUNK_SIZE - 1));
+  if (base != raw) {
+    munmap(raw, size_t(base - raw));
+  }
+  if (base + len != raw + mapped) {
+    munmap(base + len, size_t(raw + mapped - base - len));
+  }
+  // Best effort: without THP support we keep normal pages
+  if (hugePages && madvise(base, len, MADV_HUGEPAGE) != 0) {
+    perror("Cannot use huge pages for arena");
+    hugePages = false;
+  }
+  chunks.push_back(chunk{base, len});
+  cur = base;
+  end = base + len;
+}
+
+Arena::~Arena() {
+  for (auto &c : chunks) {
+    munmap(c.base, c.size);
+  }
+}
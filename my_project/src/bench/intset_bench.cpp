@@ -0,0 +1,170 @@
+// Microbenchmarks of the integer set codec (intset.hpp)
+// Usage: da_bench_intset [ITERATIONS]
+// Each codec is checked to round-trip before it is timed
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "intset.hpp"
+
+// Keeps the optimizer from dropping benchmarked work
+static volatile size_t sink;
+
+static std::vector<uint32_t> randomSet(std::mt19937 &rng, size_t size,
+                                       uint32_t maxValue) {
+  std::uniform_int_distribution<uint32_t> dist(0, maxValue);
+  std::vector<uint32_t> set;
+  while (set.size() < size) {
+    set.push_back(dist(rng));
+    if (set.size() == size) {
+      std::sort(set.begin(), set.end());
+      set.erase(std::unique(set.begin(), set.end()), set.end());
+    }
+  }
+  return set;
+}
+
+// Space separated decimal, as the text protocol would send it
+static size_t textSize(const std::vector<uint32_t> &set) {
+  size_t n = 0;
+  for (uint32_t v : set) {
+    n += std::to_string(v).length() + 1;
+  }
+  return n;
+}
+
+static void check(bool ok, const std::string &what) {
+  if (!ok) {
+    std::cerr << "Round trip failed: " << what << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+template <typename F> static double nsPerOp(unsigned long iterations, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < iterations; i++) {
+    f();
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / static_cast<double>(iterations);
+}
+
+static void benchFull(unsigned long iterations, size_t size,
+                      uint32_t maxValue) {
+  std::mt19937 rng(42);
+  auto set = randomSet(rng, size, maxValue);
+  std::string buf;
+  std::vector<uint32_t> out;
+
+  encodeSet(set, buf);
+  const char *cur = buf.data();
+  check(decodeSet(cur, buf.data() + buf.size(), out) &&
+            cur == buf.data() + buf.size() && out == set,
+        "full set of " + std::to_string(set.size()));
+  check(!memchr(buf.data(), 0, buf.size()), "NUL in a full set");
+
+  double enc = nsPerOp(iterations, [&]() {
+    buf.clear();
+    encodeSet(set, buf);
+    sink = buf.size();
+  });
+  double dec = nsPerOp(iterations, [&]() {
+    const char *p = buf.data();
+    decodeSet(p, buf.data() + buf.size(), out);
+    sink = out.size();
+  });
+  std::cout << "full  n=" << set.size() << " max=" << maxValue
+            << ": " << buf.size() << " B (text " << textSize(set)
+            << " B), encode " << enc << " ns, decode " << dec << " ns\n";
+}
+
+// A set growing by one value per round, as in successive nack rounds
+static void benchDelta(unsigned long iterations, size_t size,
+                       uint32_t maxValue) {
+  std::mt19937 rng(7);
+  auto full = randomSet(rng, size, maxValue);
+  std::vector<uint32_t> base(full.begin(), full.end() - 1);
+  std::sort(base.begin(), base.end());
+  std::string buf, fullBuf;
+  std::vector<uint32_t> out;
+  encodeSet(full, fullBuf);
+
+  encodeSetDelta(full, base, buf);
+  const char *cur = buf.data();
+  check(decodeSetDelta(cur, buf.data() + buf.size(), base, out) &&
+            cur == buf.data() + buf.size() && out == full,
+        "delta of " + std::to_string(full.size()));
+  check(!memchr(buf.data(), 0, buf.size()), "NUL in a delta");
+
+  double enc = nsPerOp(iterations, [&]() {
+    buf.clear();
+    encodeSetDelta(full, base, buf);
+    sink = buf.size();
+  });
+  double dec = nsPerOp(iterations, [&]() {
+    const char *p = buf.data();
+    decodeSetDelta(p, buf.data() + buf.size(), base, out);
+    sink = out.size();
+  });
+  std::cout << "delta n=" << full.size() << " (+1): " << buf.size()
+            << " B (full " << fullBuf.size() << " B), encode " << enc
+            << " ns, decode " << dec << " ns\n";
+}
+
+// Sets growing from empty (value 0 included) over rounds, exchanged as
+// records packed in NUL-separated packets like UDPSocket sends them
+static void checkRecords() {
+  std::mt19937 rng(3);
+  SetDeltaEncoder encoder(1);
+  SetDeltaDecoder decoder(1);
+  std::vector<uint32_t> set;
+  for (unsigned long round = 0; round < 64; round++) {
+    std::string packet;
+    for (unsigned long slot = 1; slot <= 3; slot++) {
+      std::string record;
+      encoder.encodeFor(0, slot, set, record);
+      packet += 'l' + record + '\0'; // MSG_SET record
+    }
+    for (const char *r = packet.data(); r < packet.data() + packet.size();) {
+      size_t n = strnlen(r, packet.size() - size_t(r - packet.data()));
+      unsigned long slot;
+      std::vector<uint32_t> out;
+      std::string ack;
+      check(decoder.decodeFrom(0, std::string(r + 1, n - 1), slot, out, ack) &&
+                out == set && encoder.acknowledge(0, ack),
+            "record of " + std::to_string(set.size()) + " in round " +
+                std::to_string(round));
+      r += n + 1;
+    }
+    // Grow, by a value 0 on the second round
+    auto more = randomSet(rng, round % 8 + 1, INT32_MAX);
+    if (round == 1) {
+      more.insert(more.begin(), 0);
+    }
+    std::vector<uint32_t> grown;
+    std::set_union(set.begin(), set.end(), more.begin(), more.end(),
+                   std::back_inserter(grown));
+    set.swap(grown);
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                      : 100000;
+  checkRecords();
+  for (size_t size : {8, 64, 512, 4096}) {
+    benchFull(iterations, size, static_cast<uint32_t>(4 * size));
+    benchFull(iterations, size, INT32_MAX);
+  }
+  for (size_t size : {8, 64, 512, 4096}) {
+    benchDelta(iterations, size, INT32_MAX);
+  }
+  return EXIT_SUCCESS;
+}
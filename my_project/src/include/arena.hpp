@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+// Size of a cache line: per-peer slots never share one
+#define CACHE_LINE_SIZE 64
+// Arena memory is mapped in chunks of (multiples of) one huge page
+#define ARENA_CHUNK_SIZE (2UL << 20)
+// Environment variable asking for transparent huge pages
+#define ARENA_HUGEPAGES_ENV "DA_HUGEPAGES"
+
+// Bump allocator for per-peer protocol state, which lives as long as the
+// process: memory is only returned when the arena is destroyed
+// Chunks are aligned on huge pages and, with DA_HUGEPAGES set, madvise'd so
+// that all per-peer state of up to hundreds of hosts sits in a few TLB entries
+class Arena {
+public:
+  // Shared arena of the per-peer arrays below
+  static Arena &peers();
+  void *allocate(size_t size, size_t align = CACHE_LINE_SIZE);
+  ~Arena();
+
+private:
+  Arena();
+  struct chunk {
+    char *base;
+    size_t size;
+  };
+  std::vector<chunk> chunks;
+  char *cur;
+  char *end;
+  bool hugePages;
+  std::mutex mut;
+  void grow(size_t);
+};
+
+// Contiguous array of one T per host, indexed by host id - 1
+// Each element has its own cache lines, so listener threads working on
+// different peers never falsely share
+template <class T> class PeerArray {
+  struct slot {
+    alignas(CACHE_LINE_SIZE) T value;
+  };
+
+public:
+  PeerArray() : slots(nullptr), n(0) {}
+  explicit PeerArray(size_t n) : PeerArray() { assign(n); }
+  PeerArray(const PeerArray &) = delete;
+  PeerArray &operator=(const PeerArray &) = delete;
+  ~PeerArray() { clear(); }
+
+  // Not thread-safe! Default-constructs n elements, only once: the arena
+  // cannot take storage back, so a second call would leak the first array
+  void assign(size_t count) {
+    if (slots) {
+      throw std::logic_error("PeerArray can only be assigned once");
+    }
+    slots = static_cast<slot *>(
+        Arena::peers().allocate(count * sizeof(slot), alignof(slot)));
+    for (size_t i = 0; i < count; i++) {
+      new (&slots[i]) slot();
+    }
+    n = count;
+  }
+  T &operator[](size_t i) { return slots[i].value; }
+  const T &operator[](size_t i) const { return slots[i].value; }
+  size_t size() const { return n; }
+
+  class iterator {
+  public:
+    iterator(slot *s) : s(s) {}
+    T &operator*() const { return s->value; }
+    iterator &operator++() {
+      ++s;
+      return *this;
+    }
+    bool operator!=(const iterator &o) const { return s != o.s; }
+
+  private:
+    slot *s;
+  };
+  iterator begin() { return iterator(slots); }
+  iterator end() { return iterator(slots + n); }
+
+private:
+  slot *slots;
+  size_t n;
+
+  void clear() {
+    for (size_t i = 0; i < n; i++) {
+      slots[i].~slot();
+    }
+    slots = nullptr;
+    n = 0;
+  }
+};
+
+// rows x cols table of a trivial T (e.g. [host][origin] watermarks), zeroed
+// Rows start on their own cache line; m[row][col] like a nested vector
+template <class T> class PeerMatrix {
+public:
+  PeerMatrix(size_t rows, size_t cols)
+      : stride((cols * sizeof(T) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE *
+               CACHE_LINE_SIZE / sizeof(T)),
+        data(static_cast<T *>(
+            Arena::peers().allocate(rows * stride * sizeof(T)))) {
+    for (size_t i = 0; i < rows * stride; i++) {
+      data[i] = T();
+    }
+  }
+  PeerMatrix(const PeerMatrix &) = delete;
+  PeerMatrix &operator=(const PeerMatrix &) = delete;
+  T *operator[](size_t row) { return data + row * stride; }
+  const T *operator[](size_t row) const { return data + row * stride; }
+
+private:
+  size_t stride; // in elements
+  T *data;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Compact binary encoding of sorted integer sets (lattice agreement payloads)
+// A set is its size followed by the gaps between consecutive values, all as
+// LEB128 varints. Every varint holds a value of at least 1 (sizes are sent
+// plus one, the first value as a gap from -1), so no encoded byte is NUL and
+// an encoding travels as the text of a NUL-terminated record.
+// Decoders advance `p` and return false on malformed input.
+void putVarint(std::string &, uint64_t);
+bool getVarint(const char *&p, const char *end, uint64_t &);
+void encodeSet(const std::vector<uint32_t> &, std::string &);
+bool decodeSet(const char *&p, const char *end, std::vector<uint32_t> &);
+
+// Delta of `set` against a `base` subset of it: base size, then set \ base
+void encodeSetDelta(const std::vector<uint32_t> &set,
+                    const std::vector<uint32_t> &base, std::string &);
+// Fails if the encoded base size does not match `base`
+bool decodeSetDelta(const char *&p, const char *end,
+                    const std::vector<uint32_t> &base,
+                    std::vector<uint32_t> &set);
+
+// Per-peer, per-slot delta exchange of growing sets
+// A set record is "<slot> " then the delta of the set against the last one
+// the peer acknowledged; the receiver answers "<slot> <size>" with the size
+// of the set it now knows, or 0 if it missed the base, to get a full set.
+// Sets only grow within a slot, so their size identifies them.
+
+// Sender side
+class SetDeltaEncoder {
+public:
+  SetDeltaEncoder(size_t nbPeers) : peers(nbPeers) {}
+  void encodeFor(size_t peer, unsigned long slot,
+                 const std::vector<uint32_t> &, std::string &record);
+  bool acknowledge(size_t peer, const std::string &ack); // false if malformed
+  void forget(unsigned long slot); // slot decided, for every peer
+
+private:
+  struct slotState {
+    std::vector<uint32_t> sent;  // last set sent
+    std::vector<uint32_t> acked; // last set acked, base of the next delta
+  };
+  std::vector<std::map<unsigned long, slotState>> peers;
+};
+
+// Receiver side: keeps the latest set of each peer and slot, the base of its
+// next deltas. Any set the peer sent in the slot since its base is a superset
+// of it, so deltas decode against it too; a delta arriving after a later one
+// decodes to the later (larger) set, which joining receivers do not mind.
+class SetDeltaDecoder {
+public:
+  SetDeltaDecoder(size_t nbPeers) : peers(nbPeers) {}
+  // False if malformed; `ack` is the answer to send back, empty only if the
+  // slot itself is unreadable
+  bool decodeFrom(size_t peer, const std::string &record, unsigned long &slot,
+                  std::vector<uint32_t> &set, std::string &ack);
+  void forget(unsigned long slot);
+
+private:
+  std::vector<std::map<unsigned long, std::vector<uint32_t>>> peers;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "outputfile.hpp"
+#include "parser.hpp"
+#include "urb.hpp"
+
+// Protocol layers on top of the perfect links, plugged into the UDPSocket
+// pipeline at compile time (see UDPSocket::listener)
+// deliver() gets every received normal message and returns whether it may be
+// acked (false for a message it cannot take yet, which the sender retries);
+// the other handlers get the one-shot records of the same type, a layer
+// ignoring a record type leaves an empty handler, which compiles to nothing
+// summary() returns false if (part of) the record was malformed
+// Set records (intset.hpp) are for lattice agreement, which has no layer yet
+
+// Messages delivered from one peer: perfect-link payloads are sequence
+// numbers, kept as a contiguous prefix then a bitmap of the later ones
+struct peerDelivered {
+  enum mark { Marked, Duplicate, Rejected }; // rejected: malformed, too far
+  std::mutex mut;
+  unsigned long prefix = 0;
+  std::vector<uint64_t> above; // bit i: prefix + 1 + i
+  mark tryMark(const std::string &);
+};
+
+// Perfect links alone: logs each message the first time it is received
+class PerfectLinkLayer {
+public:
+  PerfectLinkLayer(OutputFile *logFile, std::mutex &logMutex, size_t nbHosts)
+      : logFile(logFile), logMutex(logMutex), delivered(nbHosts) {}
+  bool deliver(Parser::Host *from, const std::string &msg) {
+    peerDelivered &d = delivered[from->id - 1];
+    d.mut.lock();
+    peerDelivered::mark m = d.tryMark(msg);
+    d.mut.unlock();
+    if (m == peerDelivered::Marked) {
+      logMutex.lock();
+      logFile->writeLine("d " + std::to_string(from->id) + " " + msg);
+      logMutex.unlock();
+    }
+    return m != peerDelivered::Rejected;
+  }
+  void watermarks(Parser::Host *, const std::string &) {}
+  bool summary(Parser::Host *, const std::string &) { return true; }
+  void sets(Parser::Host *, const std::string &) {}
+  void setAcks(Parser::Host *, const std::string &) {}
+
+private:
+  OutputFile *logFile;
+  std::mutex &logMutex;
+  PeerArray<peerDelivered> delivered; // indexed by host id - 1
+};
+
+// FIFO uniform reliable broadcast
+class URBLayer {
+public:
+  URBLayer(URB &urb) : urb(urb) {}
+  bool deliver(Parser::Host *from, const std::string &msg) {
+    return urb.receive(from, msg);
+  }
+  void watermarks(Parser::Host *from, const std::string &msg) {
+    urb.receiveWatermarks(from, msg);
+  }
+  bool summary(Parser::Host *from, const std::string &msg) {
+    return urb.receiveSummary(from, msg);
+  }
+  void sets(Parser::Host *, const std::string &) {}
+  void setAcks(Parser::Host *, const std::string &) {}
+
+private:
+  URB &urb;
+};
@@ -2,6 +2,7 @@
 
 #include <atomic>
 #include <csignal>
+#include <cstdint>
 #include <mutex>
 #include <netinet/in.h>
 #include <stdlib.h>
@@ -9,22 +10,96 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "outputfile.hpp"
 #include "parser.hpp"
 #include "pendinglist.hpp"
 
+class PacketTrace;
+class UringTransport;
+
+void ttyLog(std::string message);
+
+// Instrumentation policies of the UDPSocket pipeline
+// log() gets a callable building the line, only called when tracing, so
+// NoInstrumentation compiles tracing out entirely
+struct NoInstrumentation {
+  template <class F> static void log(F &&) {}
+};
+struct TtyInstrumentation {
+  template <class F> static void log(F &&f) { ttyLog(f()); }
+};
+#ifdef DEBUG_MODE
+using DefaultInstrumentation = TtyInstrumentation;
+#else
+using DefaultInstrumentation = NoInstrumentation;
+#endif
+
 #define MAX_PACKET_LENGTH 1024
 #define LOCALHOST "127.0.0.1"
 #define DEFAULTPORT 0
 
+// Message types, sent as the first byte of each record
+// A packet holds one or more NUL-terminated records: type byte then text
+#define MSG_NORMAL 'b'
+#define MSG_ACK 'a'
+#define MSG_WATERMARK 's'
+#define MSG_SEEN 'r'
+#define MSG_SET 'l'     // set delta, see intset.hpp
+#define MSG_SET_ACK 'k' // size of the set now known
+
+// Environment variables tuning the sender batching policy
+#define BATCH_MODE_ENV "DA_BATCH"       // latency, throughput or adaptive
+#define BATCH_WAIT_ENV "DA_BATCH_WAIT_US"
+#define BATCH_BYTES_ENV "DA_BATCH_BYTES"
+// Defaults of the batching policy
+#define BATCH_WAIT_US 200
+#define BATCH_BYTES (MAX_PACKET_LENGTH - 1)
+// Pending messages above which adaptive mode batches like throughput mode
+#define BATCH_ADAPTIVE_DEPTH 64
+
 struct message {
-  message(Parser::Host *d, std::string m, size_t n, bool ack = false,
+  message(Parser::Host *d, std::string m, size_t n, char type = MSG_NORMAL,
           message *next = nullptr)
-      : destHost(d), msg(m), len(n), ack(ack), next(next){};
+      : destHost(d), msg(m), len(n), type(type), next(next), firstSent(0),
+        retransmissions(0), outstanding(nullptr), origin(0), seq(0){};
+  ~message() {
+    if (outstanding) {
+      (*outstanding)--;
+    }
+  }
   Parser::Host *destHost;
   std::string msg;
   size_t len;
-  bool ack;
+  char type;
   message *next;
+  uint64_t firstSent; // LatencyStats::now() at first send, 0 if never sent
+  unsigned long retransmissions;
+  // Counter of queued messages the owner rate-limits on, if set
+  std::atomic<unsigned long> *outstanding;
+  // URB relays: (origin, seq) of the message, so that it is found without
+  // parsing its text; 0 otherwise
+  unsigned long origin;
+  unsigned long seq;
+  // Only normal messages are retransmitted until acked
+  bool oneShot() const { return type != MSG_NORMAL; }
+};
+
+// How long the sender waits to fill a packet for one destination
+// Latency mode sends what is already queued; throughput mode waits up to
+// `waitUs` for more, until `bytes`; adaptive waits only under load
+struct BatchPolicy {
+  enum Mode { Latency, Throughput, Adaptive };
+  BatchPolicy()
+      : mode(Adaptive), waitUs(BATCH_WAIT_US), bytes(BATCH_BYTES),
+        adaptiveDepth(BATCH_ADAPTIVE_DEPTH) {}
+  Mode mode;
+  unsigned long waitUs;
+  size_t bytes;
+  size_t adaptiveDepth;
+  bool shouldWait(size_t depth) const {
+    return mode == Throughput || (mode == Adaptive && depth >= adaptiveDepth);
+  }
+  static BatchPolicy fromEnv();
 };
 
 class UDPSocket {
@@ -34,13 +109,32 @@ public:
   ssize_t unicast(const Parser::Host *, const char *, ssize_t, int = 0);
   ssize_t unicast(sockaddr_in *, const char *, ssize_t, int = 0);
   ssize_t recv(sockaddr_in &, char *, ssize_t, int = 0);
-  void listener(PendingList &, std::ofstream *, std::mutex &,
-                std::vector<Parser::Host> &, std::atomic_bool &);
+  // Pipeline specialized on the protocol layer (layers.hpp) and
+  // instrumentation, explicitly instantiated in messaging.cpp
+  template <class Layer, class Instr = DefaultInstrumentation>
+  void listener(PendingList &, Layer &, std::vector<Parser::Host> &,
+                std::atomic_bool &);
+  template <class Instr = DefaultInstrumentation>
   void sender(PendingList &, const std::vector<Parser::Host> &,
               std::atomic_bool &);
+  // Records every received datagram, if set
+  void setTrace(PacketTrace *t) { trace = t; }
+  // Switches to the io_uring transport, false if unsupported
+  bool useUring();
+  // Submits batched sends, if the transport batches them
+  void flush();
+  void setBatchPolicy(const BatchPolicy &p) { batching = p; }
+  // Handles one received (NUL-terminated) datagram, without any socket
+  template <class Layer, class Instr = DefaultInstrumentation>
+  static void process(PendingList &, Layer &, std::vector<Parser::Host> &,
+                      const sockaddr_in &, const char *, ssize_t);
 
 private:
   int sockfd;
-};
-
-void ttyLog(std::string message);
\ No newline at end of file
+  PacketTrace *trace;
+  UringTransport *uring;
+  BatchPolicy batching;
+  template <class Layer, class Instr>
+  static void processRecord(PendingList &, Layer &, Parser::Host *,
+                            const char *);
+};
\ No newline at end of file
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <sys/types.h>
+
+// Size of each preallocated and mapped window of the output file
+#define OUTPUT_WINDOW_SIZE (64UL << 20)
+
+// Append-only output file written through an mmap'd window
+// Lines are memcpy'd into a MAP_SHARED region, so they survive a crash of the
+// process; the file is truncated to its real length on close()
+class OutputFile {
+public:
+  OutputFile() : fd(-1), window(nullptr), windowOffset(0), length(0) {}
+  void open(const char *);
+  void write(const char *, size_t);
+  void writeLine(const std::string &);
+  void close();
+  ~OutputFile();
+
+private:
+  int fd;
+  char *window;
+  off_t windowOffset; // file offset of the mapped window
+  size_t length;      // bytes written so far
+  void mapWindow(off_t);
+};
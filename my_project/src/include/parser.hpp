@@ -19,14 +19,12 @@
 #include <cstring>
 #include <unistd.h>
 
-#include <unordered_set>
-
 class Parser {
 public:
   struct Host {
     Host() {}
     Host(size_t id, std::string &ip_or_hostname, unsigned short port)
-        : id{id}, port{htons(port)}, seen() {
+        : id{id}, port{htons(port)} {
 
       if (isValidIpAddress(ip_or_hostname.c_str())) {
         ip = inet_addr(ip_or_hostname.c_str());
@@ -51,15 +49,8 @@ public:
       return ipReadable() + ":" +
              std::to_string(static_cast<int>(portReadable()));
     }
-    bool tryMarkSeen(std::string msg) {
-      // Not thread-safe!
-      // Try to mark as seen: if already seen return false
-      return seen.insert(msg).second;
-    }
 
   private:
-    std::unordered_set<std::string> seen;
-
     bool isValidIpAddress(const char *ipAddress) {
       struct sockaddr_in sa;
       int result = inet_pton(AF_INET, ipAddress, &(sa.sin_addr));
@@ -113,6 +104,15 @@ public:
         : nb_messages(nb_messages), rID(rID) {}
   };
 
+  struct FIFOBroadcastConfig {
+    int nb_messages;
+    FIFOBroadcastConfig() {}
+    FIFOBroadcastConfig(int nb_messages) : nb_messages(nb_messages) {}
+  };
+
+  // Kind of run, deduced from the number of values on the config first line
+  enum ConfigType { PerfectLinks, FIFOBroadcast, LatticeAgreement };
+
 public:
   Parser(const int argc, char const *const *argv, bool withConfig = true)
       : argc{argc}, argv{argv}, withConfig{withConfig}, parsed{false} {}
@@ -230,6 +230,48 @@ public:
     return values;
   }
 
+  FIFOBroadcastConfig fifoBroadcastValues() {
+    std::ifstream configFile(configPath());
+    FIFOBroadcastConfig values;
+    if (!configFile.is_open()) {
+      std::ostringstream os;
+      os << "`" << configPath() << "` does not exist.";
+      throw std::invalid_argument(os.str());
+    }
+    configFile >> values.nb_messages;
+    return values;
+  }
+
+  ConfigType configType() {
+    std::ifstream configFile(configPath());
+    if (!configFile.is_open()) {
+      std::ostringstream os;
+      os << "`" << configPath() << "` does not exist.";
+      throw std::invalid_argument(os.str());
+    }
+    std::string line;
+    std::getline(configFile, line);
+    std::istringstream iss(line);
+    long value;
+    int count = 0;
+    while (iss >> value) {
+      count++;
+    }
+    switch (count) {
+    case 1:
+      return FIFOBroadcast;
+    case 2:
+      return PerfectLinks;
+    case 3:
+      return LatticeAgreement;
+    default: {
+      std::ostringstream os;
+      os << "Unknown config format in `" << configPath() << "`";
+      throw std::invalid_argument(os.str());
+    }
+    }
+  }
+
 private:
   bool parseInternal() {
     if (!parseID()) {
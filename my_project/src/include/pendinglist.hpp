@@ -1,26 +1,66 @@
 #pragma once
+#include <chrono>
+#include <functional>
 #include <mutex>
 #include <ostream>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "parser.hpp"
+
+// Bytes credited to a destination queue at each round-robin visit
+#define DRR_QUANTUM 1024
+// Quantum divisor for destinations we have not heard from recently
+#define DRR_UNRESPONSIVE_DIVISOR 32
+// Silence after which a destination is considered unresponsive
+#define DRR_UNRESPONSIVE_MS 500
 
 struct message;
 
-// Thread-safe LinkedList to store messages
+// Thread-safe per-destination LinkedLists to store messages
+// pop() serves destinations in deficit round-robin, so a slow or crashed host
+// full of retransmissions does not starve the others
 class PendingList {
 public:
-  PendingList() : first(nullptr), last(nullptr), mut() {}
+  PendingList() : queues(), cursor(0), size(0), mut() {}
+  void init(size_t nbHosts); // before any other use
   void push(message *);
   void push_last(message *);
   void unsafe_push_last(message *);
-  int remove_instances(const std::string);
+  void heardFrom(const Parser::Host *);
+  // Per host id - 1, whether we heard nothing from it for that long
+  std::vector<bool> silent(std::chrono::milliseconds);
+  // Removes the messages of the given type and text queued for a destination
+  int remove_instances(const Parser::Host *, char, const std::string,
+                       std::function<void(const message *)> = nullptr);
+  int remove_if(std::function<bool(const message *)>);
+  // Like remove_if, but stops at the first message of each queue not matching
+  int remove_heads(std::function<bool(const message *)>);
   message *pop();
+  // Next message for `dest` if it is at most `maxLen` long and within the
+  // destination's remaining credit, to fill a packet; `full` tells the next
+  // message does not fit, so waiting for more is useless
+  message *pop_for(const Parser::Host *dest, size_t maxLen, bool &full);
+  size_t depth();
   std::ostream &display(std::ostream &out);
   ~PendingList();
 
 private:
-  message *first;
-  message *last;
+  struct destQueue {
+    message *first;
+    message *last;
+    size_t deficit;
+    std::chrono::steady_clock::time_point lastHeard;
+  };
+  PeerArray<destQueue> queues; // indexed by host id - 1
+  size_t cursor;
+  size_t size;
   std::mutex mut;
-  bool empty();
+  destQueue &queueOf(const Parser::Host *);
+  size_t quantum(const destQueue &,
+                 std::chrono::steady_clock::time_point) const;
+  int removeFrom(destQueue &, std::function<bool(const message *)> &);
 };
 
-std::ostream &operator<<(std::ostream &out, PendingList &pend);
\ No newline at end of file
+std::ostream &operator<<(std::ostream &out, PendingList &pend);
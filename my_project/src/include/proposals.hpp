@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Lazy reader of the proposals of a lattice agreement config
+// The file is mmap'd and each call to next() parses one more slot, so slot 1
+// can be proposed before later ones are even parsed
+// Malformed lines throw std::invalid_argument, like Parser
+class ProposalReader {
+public:
+  ProposalReader()
+      : path(), data(nullptr), size(0), cur(nullptr), end(nullptr), slot(0),
+        nb_proposals(0), max_proposal_size(0), distinct_values(0) {}
+  void open(const char *);
+  bool next(std::vector<uint32_t> &);
+  unsigned long slotNumber() const { return slot; } // of the last next()
+  unsigned long nbProposals() const { return nb_proposals; }
+  unsigned long maxProposalSize() const { return max_proposal_size; }
+  unsigned long distinctValues() const { return distinct_values; }
+  ~ProposalReader();
+
+private:
+  std::string path;
+  const char *data;
+  size_t size;
+  const char *cur;
+  const char *end;
+  unsigned long slot;
+  unsigned long nb_proposals;
+  unsigned long max_proposal_size;
+  unsigned long distinct_values;
+  bool number(unsigned long &, unsigned long max);
+  [[noreturn]] void fail() const;
+};
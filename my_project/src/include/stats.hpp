@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+// Sub-buckets per power of two, as log2 (3 bits: 12.5% precision)
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+// Maximum number of threads with their own histograms
+#define STATS_MAX_THREADS 32
+
+// HDR-style histogram with log-spaced buckets, lock-free updates
+class LogHistogram {
+public:
+  LogHistogram() : counts() {}
+  void record(uint64_t v) { counts[bucketOf(v)].fetch_add(1, relaxed); }
+  void addTo(uint64_t *) const;
+  static size_t bucketOf(uint64_t);
+  static uint64_t bucketValue(size_t);
+
+private:
+  static constexpr std::memory_order relaxed = std::memory_order_relaxed;
+  std::atomic<uint64_t> counts[HIST_BUCKETS];
+};
+
+// Per-message latency statistics
+// Each thread records into its own histograms, report() merges them
+class LatencyStats {
+public:
+  static uint64_t now(); // in us, never 0
+  static void recordAck(uint64_t firstSent, unsigned long retransmissions);
+  static void recordDelivery(uint64_t broadcast);
+  static void report(std::ostream &);
+
+private:
+  struct threadStats {
+    LogHistogram ackLatency;      // first send to ack, in us
+    LogHistogram retransmissions; // per acked message
+    LogHistogram deliverLatency;  // own broadcast to own delivery, in us
+  };
+  static threadStats slots[STATS_MAX_THREADS];
+  static std::atomic<size_t> nbSlots;
+  static threadStats &local();
+  static void reportOne(std::ostream &, const char *,
+                        const LogHistogram threadStats::*);
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <netinet/in.h>
+
+// Environment variables selecting the trace modes
+#define TRACE_RECORD_ENV "DA_TRACE_RECORD"
+#define TRACE_REPLAY_ENV "DA_TRACE_REPLAY"
+// Output of a replay, by default the output path suffixed with ".replay", so
+// replaying with the usual arguments leaves the recorded run's output alone
+#define TRACE_OUT_ENV "DA_TRACE_OUT"
+#define TRACE_OUT_SUFFIX ".replay"
+
+// Header of each datagram in a trace file, followed by `len` bytes
+struct traceRecord {
+  uint64_t timestamp; // CLOCK_MONOTONIC, in ns
+  in_addr_t ip;       // network order, as in sockaddr_in
+  in_port_t port;     // network order, as in sockaddr_in
+  uint16_t len;
+};
+
+// Binary trace of received datagrams, for offline replay of the receive path
+// Recording is thread-safe, reading is not
+class PacketTrace {
+public:
+  PacketTrace() : file(nullptr), mut() {}
+  void openWrite(const char *);
+  void openRead(const char *);
+  void record(const sockaddr_in &, const char *, size_t);
+  bool next(traceRecord &, char *, size_t);
+  void close();
+  ~PacketTrace();
+
+private:
+  FILE *file;
+  std::mutex mut;
+};
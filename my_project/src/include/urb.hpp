@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "arena.hpp"
+#include "outputfile.hpp"
+#include "parser.hpp"
+#include "pendinglist.hpp"
+
+// Maximum number of own messages broadcast but not yet delivered
+#define URB_WINDOW 256
+// Period of the stability watermarks exchange
+#define URB_WATERMARK_PERIOD_MS 100
+// Number of origins per watermark packet (keeps them below MAX_PACKET_LENGTH)
+#define URB_WATERMARKS_PER_PACKET 64
+// Environment variable selecting relay dissemination
+#define URB_RELAY_ENV "DA_URB_RELAY"
+// Period of the seen summaries in relay mode, divides the watermark period
+#define URB_RELAY_PERIOD_MS 2
+// Maximum text length of a summary packet (keeps them below MAX_PACKET_LENGTH)
+#define URB_SUMMARY_BYTES 1000
+// Furthest beyond our delivered prefix of an origin that a summary acks; the
+// rest is acked by later summaries, being cumulative
+#define URB_SEEN_AHEAD (16 * URB_WINDOW)
+// Silence after which a host no longer holds back garbage collection
+#define URB_SILENT_MS 1000
+
+// Majority-ack uniform reliable broadcast, with FIFO delivery per origin
+// Every process periodically sends its per-origin delivered watermarks (a
+// peer has at most one set queued, so a crashed one does not pile them up)
+// and, at the same period, garbage collects all state of messages below the
+// minimum watermark (delivered by everyone), including their pending
+// retransmissions
+// Hosts silent for URB_SILENT_MS (crashed or stopped) are left out of that
+// minimum, so a crash does not stop the collection. If such a host comes back
+// behind what was collected, the messages it misses are regenerated from
+// their (origin, seq) identifiers, a window at a time
+// By default every process relays each message to everyone through perfect
+// links, O(n^2) datagrams per message. In relay mode processes instead send
+// each peer periodic summaries "origin:seq[:extras]" of what they have seen
+// (the contiguous prefix, then a hex bitmap of later messages). A summary
+// acks all those messages at once and, messages being identified by
+// (origin, seq) alone, also disseminates them; being cumulative, summaries
+// need no acks or retransmissions. A peer only gets the origins that changed
+// since its last summary, and no new summary while its last one is queued;
+// everything is resent at each watermark period to cover losses
+class URB {
+public:
+  URB(std::vector<Parser::Host> &, Parser::Host *, PendingList &,
+      OutputFile *, std::mutex &, unsigned long, bool relay = false);
+  void broadcast();
+  void sendWatermarks(); // also collects, once per period
+  bool relaying() const { return relay; }
+  void sendSummaries(bool force = false); // force: full resend to everyone
+  bool receive(Parser::Host *, const std::string &); // false if malformed
+  void receiveWatermarks(Parser::Host *, const std::string &);
+  bool receiveSummary(Parser::Host *, const std::string &); // same
+
+private:
+  struct entry {
+    std::vector<bool> acks; // processes known to have the message
+    size_t nbAcks;
+    bool delivered; // URB-delivered, maybe not FIFO-delivered yet
+    uint64_t broadcastTime; // own messages only, for LatencyStats
+  };
+  struct originState {
+    unsigned long delivered; // FIFO-delivered prefix
+    unsigned long stable;    // prefix delivered by every process
+    std::map<unsigned long, entry> inflight;
+    unsigned long version; // bumped when a message is first seen
+  };
+
+  std::vector<Parser::Host> &hosts;
+  Parser::Host *self;
+  PendingList &pending;
+  OutputFile *logFile;
+  std::mutex &logMutex;
+  unsigned long nbMessages;
+  unsigned long lastBroadcast;
+  PeerArray<originState> origins;        // indexed by id - 1
+  PeerMatrix<unsigned long> watermarks; // [host][origin]
+  bool relay;
+  bool dirty; // seen messages changed since the last summaries
+  PeerMatrix<unsigned long> seenFrom; // [host][origin] prefix
+  PeerMatrix<unsigned long> sentVersion; // [host][origin] last summarized
+  PeerArray<std::atomic<unsigned long>> summariesQueued; // [host]
+  PeerMatrix<unsigned long> resent; // [host][origin] regenerated up to
+  PeerArray<std::atomic<unsigned long>> watermarksQueued; // [host]
+  std::mutex mut;
+
+  void unsafe_broadcast();
+  entry &track(size_t, unsigned long);
+  void pushRelay(Parser::Host *, size_t, unsigned long);
+  void ack(size_t, unsigned long, const Parser::Host *);
+  int collect(); // number of pending retransmissions dropped
+  void catchUp(Parser::Host *, size_t, size_t);
+  std::string summaryToken(size_t);
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <vector>
+
+// Environment variable requesting the io_uring transport
+#define URING_ENV "DA_IO_URING"
+// Submission queue entries (completion queue is 4 times larger)
+#define URING_ENTRIES 256
+// Provided receive buffers, power of two
+#define URING_RECV_BUFFERS 512
+// Size of each receive buffer and send slot
+#define URING_BUFFER_SIZE 2048
+// In-flight sends
+#define URING_SEND_SLOTS 256
+// Queued sends per io_uring_enter
+#define URING_SEND_BATCH 16
+// Longest wait for in-flight requests when tearing down the ring
+#define URING_DRAIN_MS 100
+
+// UDP send/receive through io_uring, with raw syscalls (no liburing)
+// Receives use one multishot recvmsg over a registered ring of provided
+// buffers; sends are copied into preallocated slots and submitted in batches.
+// init() fails on kernels or headers without these features, the caller then
+// keeps using sendto/recvfrom. A kernel rejecting the multishot receive later
+// on turns working() false: the caller goes back to sendto/recvfrom, as
+// nothing reaps send completions any more.
+class UringTransport {
+public:
+  UringTransport() : ring(nullptr), recvSupported(true) {}
+  bool init(int);
+  ssize_t send(const sockaddr_in *, const char *, size_t);
+  ssize_t recv(sockaddr_in &, char *, size_t);
+  void flush();
+  bool working() const { return recvSupported; }
+  ~UringTransport();
+
+private:
+  struct ringState;
+  ringState *ring;
+  std::mutex sqMut;   // submission queue
+  std::mutex cqMut;   // completion queue and receive buffers
+  std::mutex slotMut; // free send slots
+  std::atomic_bool recvSupported;
+  void unsafe_flush();
+  bool armRecv();
+  void drain();
+};
@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+
+#include "intset.hpp"
+
+void putVarint(std::string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+bool getVarint(const char *&p, const char *end, uint64_t &v) {
+  v = 0;
+  for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t byte = static_cast<uint8_t>(*p++);
+    v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void encodeSet(const std::vector<uint32_t> &set, std::string &out) {
+  putVarint(out, set.size() + 1);
+  uint64_t prev = 0; // previous value + 1
+  for (uint32_t v : set) {
+    putVarint(out, v + 1UL - prev);
+    prev = v + 1UL;
+  }
+}
+
+bool decodeSet(const char *&p, const char *end, std::vector<uint32_t> &set) {
+  uint64_t n, gap;
+  if (!getVarint(p, end, n) || n == 0 ||
+      n - 1 > static_cast<uint64_t>(end - p)) {
+    return false; // each value takes at least one byte
+  }
+  set.clear();
+  set.reserve(n - 1);
+  uint64_t prev = 0;
+  for (uint64_t i = 1; i < n; i++) {
+    // Gaps of a sorted set are at least 1
+    if (!getVarint(p, end, gap) || gap == 0 ||
+        prev + gap > UINT32_MAX + 1UL) {
+      return false;
+    }
+    prev += gap;
+    set.push_back(static_cast<uint32_t>(prev - 1));
+  }
+  return true;
+}
+
+void encodeSetDelta(const std::vector<uint32_t> &set,
+                    const std::vector<uint32_t> &base, std::string &out) {
+  std::vector<uint32_t> delta;
+  delta.reserve(set.size() - std::min(set.size(), base.size()));
+  std::set_difference(set.begin(), set.end(), base.begin(), base.end(),
+                      std::back_inserter(delta));
+  putVarint(out, base.size() + 1);
+  encodeSet(delta, out);
+}
+
+bool decodeSetDelta(const char *&p, const char *end,
+                    const std::vector<uint32_t> &base,
+                    std::vector<uint32_t> &set) {
+  uint64_t baseSize;
+  std::vector<uint32_t> delta;
+  if (!getVarint(p, end, baseSize) || baseSize != base.size() + 1 ||
+      !decodeSet(p, end, delta)) {
+    return false;
+  }
+  set.clear();
+  set.reserve(base.size() + delta.size());
+  std::set_union(base.begin(), base.end(), delta.begin(), delta.end(),
+                 std::back_inserter(set));
+  return true;
+}
+
+void SetDeltaEncoder::encodeFor(size_t peer, unsigned long slot,
+                                const std::vector<uint32_t> &set,
+                                std::string &record) {
+  slotState &s = peers[peer][slot];
+  record = std::to_string(slot) + " ";
+  encodeSetDelta(set, s.acked, record);
+  s.sent = set;
+}
+
+bool SetDeltaEncoder::acknowledge(size_t peer, const std::string &ack) {
+  unsigned long slot, size;
+  if (sscanf(ack.c_str(), "%lu %lu", &slot, &size) != 2) {
+    return false;
+  }
+  auto it = peers[peer].find(slot);
+  if (it == peers[peer].end()) {
+    return true; // forgotten slot
+  }
+  slotState &s = it->second;
+  if (size == 0) {
+    s.acked.clear(); // peer lost its base: next send is a full set
+  } else if (s.sent.size() == size && size > s.acked.size()) {
+    // Acks of older sends are ignored: we no longer know those sets
+    s.acked = s.sent;
+  }
+  return true;
+}
+
+void SetDeltaEncoder::forget(unsigned long slot) {
+  for (auto &slots : peers) {
+    slots.erase(slot);
+  }
+}
+
+bool SetDeltaDecoder::decodeFrom(size_t peer, const std::string &record,
+                                 unsigned long &slot,
+                                 std::vector<uint32_t> &set,
+                                 std::string &ack) {
+  ack.clear();
+  const char *p = record.c_str();
+  const char *end = p + record.length();
+  char *sep;
+  slot = strtoul(p, &sep, 10);
+  if (*p < '0' || *p > '9' || sep == end || *sep != ' ') {
+    return false;
+  }
+  p = sep + 1;
+  std::vector<uint32_t> &known = peers[peer][slot];
+  uint64_t baseSize;
+  std::vector<uint32_t> delta;
+  if (!getVarint(p, end, baseSize) || baseSize == 0 ||
+      baseSize - 1 > known.size() || !decodeSet(p, end, delta) || p != end) {
+    // Without its base (or its meaning) we ask for a full set
+    ack = std::to_string(slot) + " 0";
+    return false;
+  }
+  set.clear();
+  set.reserve(known.size() + delta.size());
+  std::set_union(known.begin(), known.end(), delta.begin(), delta.end(),
+                 std::back_inserter(set));
+  known = set;
+  ack = std::to_string(slot) + " " + std::to_string(known.size());
+  return true;
+}
+
+void SetDeltaDecoder::forget(unsigned long slot) {
+  for (auto &slots : peers) {
+    slots.erase(slot);
+  }
+}
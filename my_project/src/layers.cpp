@@ -0,0 +1,41 @@
+#include <cstdlib>
+
+#include "layers.hpp"
+
+// Bound on the bitmap, against bogus sequence numbers far ahead
+#define DELIVERED_MAX_GAP (1UL << 24)
+
+peerDelivered::mark peerDelivered::tryMark(const std::string &msg) {
+  // Not thread-safe!
+  char *endPtr;
+  unsigned long seq = strtoul(msg.c_str(), &endPtr, 10);
+  if (*endPtr != '\0' || seq == 0) {
+    return Rejected;
+  }
+  if (seq <= prefix) {
+    return Duplicate;
+  }
+  if (seq - prefix > DELIVERED_MAX_GAP) {
+    return Rejected; // not acked: retransmitted until the prefix catches up
+  }
+  size_t i = seq - prefix - 1;
+  if (i / 64 >= above.size()) {
+    above.resize(i / 64 + 1, 0);
+  }
+  uint64_t bit = uint64_t(1) << (i % 64);
+  if (above[i / 64] & bit) {
+    return Duplicate;
+  }
+  above[i / 64] |= bit;
+
+  // Slide the prefix over complete words
+  size_t full = 0;
+  while (full < above.size() && above[full] == ~uint64_t(0)) {
+    full++;
+  }
+  if (full) {
+    above.erase(above.begin(), above.begin() + long(full));
+    prefix += 64 * full;
+  }
+  return Marked;
+}
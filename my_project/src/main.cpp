@@ -1,5 +1,6 @@
 #include <atomic>
 #include <chrono>
+#include <cstring>
 #include <iostream>
 #include <mutex>
 
@@ -7,30 +8,40 @@
 #include <thread>
 
 #include "defines.hpp"
+#include "layers.hpp"
 #include "messaging.hpp"
+#include "outputfile.hpp"
 #include "parser.hpp"
 #include "pendinglist.hpp"
+#include "proposals.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "urb.hpp"
+#include "uring.hpp"
 
 #define NLISTENERS 4
 #define NSENDERS 3
 
 using namespace std;
 
-ofstream logFile;
+OutputFile logFile;
 std::mutex logMutex;
 
 thread listenerThreads[NLISTENERS];
 thread senderThreads[NSENDERS];
 
 PendingList pending;
+URB *urb = nullptr;
+PacketTrace trace;
+ProposalReader proposals;
 
 atomic_bool stopThreads;
+atomic_bool stopRequested;
+atomic_bool statsRequested;
 
-static void stop(int) {
-  // set default handlers
-  signal(SIGTERM, SIG_DFL);
-  signal(SIGINT, SIG_DFL);
-
+// Runs on the main thread: the signal handler may interrupt a thread holding
+// a mutex that the listeners or senders wait for, so it cannot join them
+static void stop() {
   // immediately stop network packet processing
 #ifdef DEBUG_MODE
   cout << "Stopping network packet processing.\n";
@@ -57,14 +68,77 @@ static void stop(int) {
   cout << "Closing logfile.\n";
 #endif
   logFile.close();
+  trace.close();
+
+  LatencyStats::report(cout);
 
-  // exit directly from signal handler
   exit(0);
 }
 
+// The main loop stops the process; a second signal kills it immediately
+static void requestStop(int) {
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  stopRequested = true;
+}
+
+// Feeds a recorded trace through the receive path as fast as possible
+template <class Layer>
+static void replay(const char *path, Layer &layer,
+                   vector<Parser::Host> &hosts) {
+  PacketTrace input;
+  input.openRead(path);
+  traceRecord rec;
+  char buffer[MAX_PACKET_LENGTH];
+  sockaddr_in from;
+  memset(&from, 0, sizeof(from));
+  from.sin_family = AF_INET;
+  unsigned long nb = 0;
+
+  auto start = chrono::steady_clock::now();
+  while (!stopRequested && input.next(rec, buffer, MAX_PACKET_LENGTH - 1)) {
+    buffer[rec.len] = 0;
+    from.sin_addr.s_addr = rec.ip;
+    from.sin_port = rec.port;
+    UDPSocket::process(pending, layer, hosts, from, buffer, rec.len);
+    // Nothing is sent: drop the acks and control records the pipeline
+    // pushed in front, the send queue stays as in a real run
+    pending.remove_heads(
+        [](const message *m) noexcept { return m->oneShot(); });
+    nb++;
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  cout << "Replayed " << nb << " packets in " << elapsed.count() << " s ("
+       << static_cast<double>(nb) / elapsed.count() << " packets/s)" << endl;
+  logFile.close();
+}
+
+// Starts the listeners and senders, specialized on the protocol layer
+template <class Layer>
+static void startPipeline(UDPSocket &sock, Layer &layer,
+                          vector<Parser::Host> &hosts) {
+  // Start listener(s)
+  for (int i = 0; i < NLISTENERS; i++) {
+    listenerThreads[i] =
+        thread(&UDPSocket::listener<Layer>, &sock, std::ref(pending),
+               std::ref(layer), std::ref(hosts), std::ref(stopThreads));
+  }
+
+  // Start sender(s)
+  for (int i = 0; i < NSENDERS; i++) {
+    senderThreads[i] = thread(&UDPSocket::sender<>, &sock, std::ref(pending),
+                              std::ref(hosts), std::ref(stopThreads));
+  }
+}
+
+// Statistics are printed by the main loop, outside of the signal handler
+static void requestStats(int) { statsRequested = true; }
+
 int main(int argc, char **argv) {
-  signal(SIGTERM, stop);
-  signal(SIGINT, stop);
+  signal(SIGTERM, requestStop);
+  signal(SIGINT, requestStop);
+  signal(SIGUSR1, requestStats);
 
   // `true` means that a config file is required.
   // Call with `false` if no config file is necessary.
@@ -85,13 +159,37 @@ int main(int argc, char **argv) {
 #endif
 
   // Parse config file
-  Parser::PerfectLinkConfig vals = parser.perfectLinkValues();
+  Parser::ConfigType configType = parser.configType();
+  Parser::PerfectLinkConfig vals(0, 0);
+  Parser::FIFOBroadcastConfig fifoVals(0);
+  if (configType == Parser::FIFOBroadcast) {
+    fifoVals = parser.fifoBroadcastValues();
 #ifdef DEBUG_MODE
-  cout << "Perfect Link config:" << endl;
-  cout << "==========================\n";
-  cout << vals.nb_messages << " messages to be sent to " << vals.rID << endl;
-  cout << endl;
+    cout << "FIFO Broadcast config:" << endl;
+    cout << "==========================\n";
+    cout << fifoVals.nb_messages << " messages to be broadcast" << endl;
+    cout << endl;
+#endif
+  } else if (configType == Parser::LatticeAgreement) {
+    // Proposals are parsed lazily, slot by slot
+    proposals.open(parser.configPath());
+#ifdef DEBUG_MODE
+    cout << "Lattice Agreement config:" << endl;
+    cout << "==========================\n";
+    cout << proposals.nbProposals() << " proposals of at most "
+         << proposals.maxProposalSize() << " values, "
+         << proposals.distinctValues() << " distinct values" << endl;
+    cout << endl;
 #endif
+  } else {
+    vals = parser.perfectLinkValues();
+#ifdef DEBUG_MODE
+    cout << "Perfect Link config:" << endl;
+    cout << "==========================\n";
+    cout << vals.nb_messages << " messages to be sent to " << vals.rID << endl;
+    cout << endl;
+#endif
+  }
 
 // Parse hosts file
 #ifdef DEBUG_MODE
@@ -99,6 +197,7 @@ int main(int argc, char **argv) {
   cout << "==========================\n";
 #endif
   auto hosts = parser.hosts();
+  pending.init(hosts.size());
   Parser::Host *self_host = NULL;
   Parser::Host *dest_host = NULL;
 
@@ -141,24 +240,27 @@ int main(int argc, char **argv) {
   cout << "===============\n";
 #endif
 
-  stopThreads = false;
-// Create UDP socket
-#ifdef DEBUG_MODE
-  cout << "Creating socket on " << self_host->ipReadable() << ":"
-       << self_host->portReadable() << endl;
-#endif
-  UDPSocket sock = UDPSocket(self_host->ip, self_host->port);
-
-  // Open logfile
-  logFile.open(parser.outputPath());
+  // Open logfile, a separate one when replaying
+  if (!getenv(TRACE_REPLAY_ENV)) {
+    logFile.open(parser.outputPath());
+  } else if (getenv(TRACE_OUT_ENV)) {
+    logFile.open(getenv(TRACE_OUT_ENV));
+  } else {
+    logFile.open((string(parser.outputPath()) + TRACE_OUT_SUFFIX).c_str());
+  }
 
   // Build message queue
-  if (self_host != dest_host) {
+  if (configType == Parser::FIFOBroadcast) {
+    urb = new URB(hosts, self_host, pending, &logFile, logMutex,
+                  static_cast<unsigned long>(fifoVals.nb_messages),
+                  getenv(URB_RELAY_ENV) != nullptr);
+    urb->broadcast();
+  } else if (self_host != dest_host) {
     for (int i = 1; i <= vals.nb_messages; i++) {
       message *current =
           new message{dest_host, to_string(i), to_string(i).length() + 1};
       pending.unsafe_push_last(current); // no multithreading yet
-      logFile << "b " << current->msg << std::endl;
+      logFile.writeLine("b " + current->msg);
     }
   }
 
@@ -166,17 +268,46 @@ int main(int argc, char **argv) {
   cout << "Message list:\n" << pending << endl;
 #endif
 
-  // Start listener(s)
-  for (int i = 0; i < NLISTENERS; i++) {
-    listenerThreads[i] =
-        thread(&UDPSocket::listener, &sock, std::ref(pending), &logFile,
-               std::ref(logMutex), std::ref(hosts), std::ref(stopThreads));
+  // Protocol on top of the perfect links, fixed for the whole run
+  PerfectLinkLayer plLayer(&logFile, logMutex, hosts.size());
+  URBLayer *urbLayer = urb ? new URBLayer(*urb) : nullptr;
+
+  // Offline replay of a recorded trace, without sockets
+  if (getenv(TRACE_REPLAY_ENV)) {
+    if (urbLayer) {
+      replay(getenv(TRACE_REPLAY_ENV), *urbLayer, hosts);
+    } else {
+      replay(getenv(TRACE_REPLAY_ENV), plLayer, hosts);
+    }
+    return 0;
   }
 
-  // Start sender(s)
-  for (int i = 0; i < NSENDERS; i++) {
-    senderThreads[i] = thread(&UDPSocket::sender, &sock, std::ref(pending),
-                              std::ref(hosts), std::ref(stopThreads));
+  stopThreads = false;
+// Create UDP socket
+#ifdef DEBUG_MODE
+  cout << "Creating socket on " << self_host->ipReadable() << ":"
+       << self_host->portReadable() << endl;
+#endif
+  UDPSocket sock = UDPSocket(self_host->ip, self_host->port);
+
+  // Optional io_uring transport
+  if (getenv(URING_ENV) && !sock.useUring()) {
+    cerr << "io_uring unavailable, using sendto/recvfrom" << endl;
+  }
+
+  // Packet batching, tuned from the environment
+  sock.setBatchPolicy(BatchPolicy::fromEnv());
+
+  // Record received datagrams
+  if (getenv(TRACE_RECORD_ENV)) {
+    trace.openWrite(getenv(TRACE_RECORD_ENV));
+    sock.setTrace(&trace);
+  }
+
+  if (urbLayer) {
+    startPipeline(sock, *urbLayer, hosts);
+  } else {
+    startPipeline(sock, plLayer, hosts);
   }
 
 #ifdef DEBUG_MODE
@@ -185,8 +316,29 @@ int main(int argc, char **argv) {
 
   // After a process finishes broadcasting,
   // it waits forever for the delivery of messages.
-  while (true) {
-    this_thread::sleep_for(chrono::hours(1));
+  // Relay mode wakes up more often, to send its summaries
+  unsigned long period = urb && urb->relaying() ? URB_RELAY_PERIOD_MS
+                                                : URB_WATERMARK_PERIOD_MS;
+  for (unsigned long elapsed = period;; elapsed += period) {
+    this_thread::sleep_for(chrono::milliseconds(period));
+    if (stopRequested) {
+      stop();
+    }
+    bool watermarkTick = elapsed % URB_WATERMARK_PERIOD_MS == 0;
+    if (urb && urb->relaying()) {
+      urb->sendSummaries(watermarkTick); // resent periodically, may be lost
+    }
+    if (!watermarkTick) {
+      continue;
+    }
+    // Broadcast keeps exchanging stability watermarks
+    if (urb) {
+      urb->sendWatermarks();
+      urb->broadcast();
+    }
+    if (statsRequested.exchange(false)) {
+      LatencyStats::report(cout);
+    }
   }
 
   return 0;
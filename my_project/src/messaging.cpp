@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <arpa/inet.h>
 #include <atomic>
+#include <chrono>
 #include <cstring>
 #include <errno.h>
 #include <fcntl.h>
@@ -12,13 +14,20 @@
 #include <string>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
 
 #include "defines.hpp"
+#include "layers.hpp"
 #include "messaging.hpp"
+#include "outputfile.hpp"
 #include "pendinglist.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "uring.hpp"
 
-UDPSocket::UDPSocket(in_addr_t IP, unsigned short port) {
+UDPSocket::UDPSocket(in_addr_t IP, unsigned short port)
+    : trace(nullptr), uring(nullptr) {
   struct sockaddr_in sk;
 
   // Creating socket file descriptor
@@ -46,15 +55,29 @@ UDPSocket::UDPSocket(in_addr_t IP, unsigned short port) {
   return;
 }
 
-UDPSocket::~UDPSocket() { close(sockfd); }
+UDPSocket::~UDPSocket() {
+  delete uring;
+  close(sockfd);
+}
+
+bool UDPSocket::useUring() {
+  uring = new UringTransport();
+  if (!uring->init(sockfd)) {
+    delete uring;
+    uring = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void UDPSocket::flush() {
+  if (uring) {
+    uring->flush();
+  }
+}
 
 ssize_t UDPSocket::unicast(const Parser::Host *host, const char *buffer,
                            ssize_t len, int flags) {
-
-#ifdef DEBUG_MODE
-  ttyLog("Sending (full) message to " + host->fullAddressReadable() +
-         ", msg: " + buffer);
-#endif
   sockaddr_in add;
   add.sin_family = AF_INET;
   add.sin_addr.s_addr = host->ip;
@@ -64,6 +87,9 @@ ssize_t UDPSocket::unicast(const Parser::Host *host, const char *buffer,
 
 ssize_t UDPSocket::unicast(sockaddr_in *dest, const char *buffer, ssize_t len,
                            int flags) {
+  if (uring && uring->working()) {
+    return uring->send(dest, buffer, size_t(len));
+  }
   return sendto(this->sockfd, buffer, len, flags,
                 reinterpret_cast<sockaddr *>(dest), sizeof(*dest));
 }
@@ -71,8 +97,10 @@ ssize_t UDPSocket::unicast(sockaddr_in *dest, const char *buffer, ssize_t len,
 ssize_t UDPSocket::recv(sockaddr_in &from, char *buffer, ssize_t len,
                         int flags) {
   socklen_t sk_len(sizeof(from));
-  ssize_t ret = recvfrom(sockfd, buffer, len, flags,
-                         reinterpret_cast<sockaddr *>(&from), &sk_len);
+  ssize_t ret = uring && uring->working()
+                    ? uring->recv(from, buffer, size_t(len))
+                    : recvfrom(sockfd, buffer, len, flags,
+                               reinterpret_cast<sockaddr *>(&from), &sk_len);
   if (ret > 0) {
     buffer[ret] = 0;
   } else if (ret == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -81,116 +109,217 @@ ssize_t UDPSocket::recv(sockaddr_in &from, char *buffer, ssize_t len,
   return ret;
 }
 
-void UDPSocket::listener(PendingList &pending, std::ofstream *logFile,
-                         std::mutex &logMutex, std::vector<Parser::Host> &hosts,
+template <class Layer, class Instr>
+void UDPSocket::listener(PendingList &pending, Layer &layer,
+                         std::vector<Parser::Host> &hosts,
                          std::atomic_bool &flagStop) {
   while (!flagStop) {
-#ifdef DEBUG_MODE
-    ttyLog("[L] Waiting for message");
-#endif
+    Instr::log([] { return "[L] Waiting for message"; });
     char buffer[MAX_PACKET_LENGTH];
     sockaddr_in from;
     ssize_t recvd_len = -1;
     while (recvd_len == -1 && !flagStop)
-      recvd_len = recv(from, buffer, MAX_PACKET_LENGTH);
-    auto fromHost = Parser::findHost(from, hosts);
-    if (flagStop || !fromHost || recvd_len < 2) {
-#ifdef DEBUG_MODE
-      ttyLog("[L] Error while receiving");
-#endif
+      recvd_len = recv(from, buffer, MAX_PACKET_LENGTH - 1);
+    if (flagStop || recvd_len < 2) {
+      Instr::log([] { return "[L] Error while receiving"; });
       continue;
     }
-#ifdef DEBUG_MODE
-    ttyLog("[L] Received (full) from " + std::to_string(fromHost->id) + ": " +
-           buffer);
-#endif
+    if (trace) {
+      trace->record(from, buffer, size_t(recvd_len));
+    }
+    process<Layer, Instr>(pending, layer, hosts, from, buffer, recvd_len);
+  }
+  Instr::log([] { return "[L] Listener exit"; });
+}
 
-    std::string msg = std::string(buffer).substr(1);
-    switch (buffer[0]) {
-    case 'a': {
-// Ack
-#ifdef DEBUG_MODE
-      ttyLog("[L] Received ack for msg: " + msg);
-#endif
-      int nb = pending.remove_instances(msg);
-#ifdef DEBUG_MODE
-      ttyLog("[L] Removed " + std::to_string(nb) + " instances of " + msg);
-#endif
-      break;
+template <class Layer, class Instr>
+void UDPSocket::process(PendingList &pending, Layer &layer,
+                        std::vector<Parser::Host> &hosts,
+                        const sockaddr_in &from, const char *buffer,
+                        ssize_t recvd_len) {
+  auto fromHost = Parser::findHost(from, hosts);
+  if (!fromHost || recvd_len < 2) {
+    Instr::log([] { return "[L] Packet from unknown host"; });
+    return;
+  }
+  Instr::log([&] {
+    return "[L] Received (full) from " + std::to_string(fromHost->id) + ": " +
+           buffer;
+  });
+
+  pending.heardFrom(fromHost);
+
+  // Split the packet into its records
+  const char *end = buffer + recvd_len;
+  for (const char *record = buffer; record < end;) {
+    size_t n = strnlen(record, size_t(end - record));
+    if (n >= 1) {
+      processRecord<Layer, Instr>(pending, layer, fromHost, record);
     }
+    record += n + 1;
+  }
+}
 
-    case 'b': {
-      // Normal
-      message *ackMessage = new message{fromHost, msg, size_t(recvd_len), true};
-      pending.push(ackMessage);
-#ifdef DEBUG_MODE
-      ttyLog("[L] Pushed ack in sending queue for msg: " + ackMessage->msg);
-#endif
-      // If new, log into file
-      logMutex.lock();
-      if (fromHost->tryMarkSeen(msg)) {
-#ifdef DEBUG_MODE
-        ttyLog("[L] Was new: " + ackMessage->msg);
-#endif
-        (*logFile) << "d " << fromHost->id << " " << msg << std::endl;
-      }
-      logMutex.unlock();
+template <class Layer, class Instr>
+void UDPSocket::processRecord(PendingList &pending, Layer &layer,
+                              Parser::Host *fromHost, const char *buffer) {
+  std::string msg = std::string(buffer).substr(1);
+  switch (buffer[0]) {
+  case MSG_ACK: {
+    // Ack
+    Instr::log([&] { return "[L] Received ack for msg: " + msg; });
+    // Only the data messages: a queued ack with the same text must still go
+    int nb = pending.remove_instances(
+        fromHost, MSG_NORMAL, msg, [](const message *m) {
+          LatencyStats::recordAck(m->firstSent, m->retransmissions);
+        });
+    Instr::log([&] {
+      return "[L] Removed " + std::to_string(nb) + " instances of " + msg;
+    });
+    (void)nb;
+    break;
+  }
+
+  case MSG_NORMAL: {
+    // Normal
+    // Acked only once the layer took it, else the sender retransmits it
+    if (!layer.deliver(fromHost, msg)) {
+      Instr::log([&] { return "[L] Rejected msg: " + msg; });
       break;
     }
-    default: {
-#ifdef DEBUG_MODE
-      ttyLog("[L] Received weird message! Skipping...");
-#endif
-      continue;
-    }
+    message *ackMessage = new message{fromHost, msg, msg.length() + 1, MSG_ACK};
+    pending.push(ackMessage);
+    Instr::log(
+        [&] { return "[L] Pushed ack in sending queue for msg: " + msg; });
+    break;
+  }
+  case MSG_WATERMARK: {
+    layer.watermarks(fromHost, msg);
+    break;
+  }
+  case MSG_SET: {
+    layer.sets(fromHost, msg);
+    break;
+  }
+  case MSG_SET_ACK: {
+    layer.setAcks(fromHost, msg);
+    break;
+  }
+  case MSG_SEEN: {
+    if (!layer.summary(fromHost, msg)) {
+      Instr::log([&] { return "[L] Malformed summary: " + msg; });
     }
+    break;
+  }
+  default: {
+    Instr::log([] { return "[L] Received weird message! Skipping..."; });
+    break;
+  }
   }
-#ifdef DEBUG_MODE
-  ttyLog("[L] Listener exit");
-#endif
 }
 
+template <class Instr>
 void UDPSocket::sender(PendingList &pending,
                        const std::vector<Parser::Host> &hosts,
                        std::atomic_bool &flagStop) {
+  std::vector<message *> batch;
+  std::string packet;
+  size_t maxBytes = std::min<size_t>(batching.bytes, MAX_PACKET_LENGTH - 1);
   while (!flagStop) {
-#ifdef DEBUG_MODE
-    ttyLog("[S] Ready to send");
-#endif
+    Instr::log([] { return "[S] Ready to send"; });
     message *current = pending.pop();
     if (!current) {
-#ifdef DEBUG_MODE
-      ttyLog("[S] Sending queue empty...");
-#endif
+      Instr::log([] { return "[S] Sending queue empty..."; });
+      flush();
       continue;
     }
-    // Add correct directional byte
-    auto full_text = (current->ack ? "a" : "b") + current->msg;
-    ssize_t sent =
-        unicast(current->destHost, full_text.c_str(), current->len + 1);
-
-    if (sent < 0) {
-#ifdef DEBUG_MODE
-      ttyLog("[S] Error sending msg!");
-#endif
-      continue;
-    } else {
-#ifdef DEBUG_MODE
-      ttyLog("[S] Sent: " + full_text);
-#endif
+
+    // Fill the packet with more records for the same destination
+    Parser::Host *dest = current->destHost;
+    bool wait = batching.shouldWait(pending.depth());
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::microseconds(batching.waitUs);
+    batch.clear();
+    packet.clear();
+    while (current) {
+      if (!current->firstSent) {
+        current->firstSent = LatencyStats::now();
+      } else {
+        current->retransmissions++;
+      }
+      // Add correct directional byte
+      packet.push_back(current->type);
+      packet.append(current->msg);
+      packet.push_back('\0');
+      batch.push_back(current);
+
+      current = nullptr;
+      bool full = false;
+      while (packet.size() + 2 < maxBytes) {
+        current = pending.pop_for(dest, maxBytes - packet.size() - 1, full);
+        if (current || full || !wait || flagStop ||
+            std::chrono::steady_clock::now() >= deadline) {
+          break;
+        }
+        std::this_thread::yield();
+      }
     }
-    if (!current->ack) {
-#ifdef DEBUG_MODE
-      ttyLog("[S] Repushing message in line");
-#endif
-      pending.push_last(current);
-    } else {
-      delete current;
+
+    ssize_t sent = unicast(dest, packet.data(), ssize_t(packet.size()));
+    Instr::log([&] {
+      return sent < 0 ? std::string("[S] Error sending msg!")
+                      : "[S] Sent " + std::to_string(batch.size()) +
+                            " records to " + dest->fullAddressReadable() +
+                            ", first: " + packet.c_str();
+    });
+    for (message *m : batch) {
+      // Failed sends (io_uring out of slots) are retried like losses
+      if (!m->oneShot()) {
+        pending.push_last(m);
+      } else {
+        delete m;
+      }
     }
   }
-#ifdef DEBUG_MODE
-  ttyLog("[S] Sender exit");
-#endif
+  Instr::log([] { return "[S] Sender exit"; });
+}
+
+// Pipelines of the da_proc modes (lattice agreement runs on perfect links)
+template void UDPSocket::listener<PerfectLinkLayer>(PendingList &,
+                                                    PerfectLinkLayer &,
+                                                    std::vector<Parser::Host> &,
+                                                    std::atomic_bool &);
+template void UDPSocket::listener<URBLayer>(PendingList &, URBLayer &,
+                                            std::vector<Parser::Host> &,
+                                            std::atomic_bool &);
+template void UDPSocket::process<PerfectLinkLayer>(PendingList &,
+                                                   PerfectLinkLayer &,
+                                                   std::vector<Parser::Host> &,
+                                                   const sockaddr_in &,
+                                                   const char *, ssize_t);
+template void UDPSocket::process<URBLayer>(PendingList &, URBLayer &,
+                                           std::vector<Parser::Host> &,
+                                           const sockaddr_in &, const char *,
+                                           ssize_t);
+template void UDPSocket::sender<>(PendingList &,
+                                  const std::vector<Parser::Host> &,
+                                  std::atomic_bool &);
+
+BatchPolicy BatchPolicy::fromEnv() {
+  BatchPolicy p;
+  const char *mode = getenv(BATCH_MODE_ENV);
+  if (mode && strcmp(mode, "latency") == 0) {
+    p.mode = Latency;
+  } else if (mode && strcmp(mode, "throughput") == 0) {
+    p.mode = Throughput;
+  }
+  if (getenv(BATCH_WAIT_ENV)) {
+    p.waitUs = strtoul(getenv(BATCH_WAIT_ENV), nullptr, 10);
+  }
+  if (getenv(BATCH_BYTES_ENV)) {
+    p.bytes = strtoul(getenv(BATCH_BYTES_ENV), nullptr, 10);
+  }
+  return p;
 }
 
 void ttyLog(std::string message) {
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "outputfile.hpp"
+
+void OutputFile::open(const char *path) {
+  if ((fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror("output file creation failed");
+    exit(EXIT_FAILURE);
+  }
+  length = 0;
+  mapWindow(0);
+}
+
+void OutputFile::mapWindow(off_t offset) {
+  if (window) {
+    munmap(window, OUTPUT_WINDOW_SIZE);
+    window = nullptr;
+  }
+  // Reserve the blocks up front, fall back to a sparse extension if the
+  // filesystem does not support fallocate
+  if (fallocate(fd, 0, offset, OUTPUT_WINDOW_SIZE) < 0 &&
+      ftruncate(fd, offset + static_cast<off_t>(OUTPUT_WINDOW_SIZE)) < 0) {
+    perror("output file preallocation failed");
+    exit(EXIT_FAILURE);
+  }
+  void *addr = mmap(nullptr, OUTPUT_WINDOW_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, offset);
+  if (addr == MAP_FAILED) {
+    perror("output file mapping failed");
+    exit(EXIT_FAILURE);
+  }
+  window = static_cast<char *>(addr);
+  windowOffset = offset;
+}
+
+void OutputFile::write(const char *buffer, size_t len) {
+  while (len > 0) {
+    size_t inWindow = length - static_cast<size_t>(windowOffset);
+    if (inWindow == OUTPUT_WINDOW_SIZE) {
+      mapWindow(static_cast<off_t>(length));
+      inWindow = 0;
+    }
+    size_t chunk = std::min(len, OUTPUT_WINDOW_SIZE - inWindow);
+    memcpy(window + inWindow, buffer, chunk);
+    buffer += chunk;
+    len -= chunk;
+    length += chunk;
+  }
+}
+
+void OutputFile::writeLine(const std::string &line) {
+  write(line.c_str(), line.length());
+  write("\n", 1);
+}
+
+void OutputFile::close() {
+  if (fd < 0) {
+    return;
+  }
+  if (window) {
+    munmap(window, OUTPUT_WINDOW_SIZE);
+    window = nullptr;
+  }
+  // Drop the unused preallocated tail
+  if (ftruncate(fd, static_cast<off_t>(length)) < 0) {
+    perror("output file truncation failed");
+  }
+  ::close(fd);
+  fd = -1;
+}
+
+OutputFile::~OutputFile() { close(); }
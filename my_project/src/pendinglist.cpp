@@ -1,27 +1,53 @@
 #include "pendinglist.hpp"
 #include "messaging.hpp"
 
+void PendingList::init(size_t nbHosts) {
+  queues.assign(nbHosts);
+  auto now = std::chrono::steady_clock::now();
+  for (auto &q : queues) {
+    q = destQueue{nullptr, nullptr, 0, now};
+  }
+}
+
+PendingList::destQueue &PendingList::queueOf(const Parser::Host *h) {
+  // Not thread-safe!
+  return queues[h->id - 1];
+}
+
+size_t PendingList::quantum(const destQueue &q,
+                            std::chrono::steady_clock::time_point now) const {
+  if (now - q.lastHeard > std::chrono::milliseconds(DRR_UNRESPONSIVE_MS)) {
+    return DRR_QUANTUM / DRR_UNRESPONSIVE_DIVISOR;
+  }
+  return DRR_QUANTUM;
+}
+
 void PendingList::push(message *m) {
   m->next = nullptr; // sanity
   mut.lock();
-  if (empty()) {
-    first = m;
-    last = m;
+  destQueue &q = queueOf(m->destHost);
+  if (!q.first) {
+    q.first = m;
+    q.last = m;
   } else {
-    m->next = first;
-    first = m;
+    m->next = q.first;
+    q.first = m;
   }
+  size++;
   mut.unlock();
 }
+
 void PendingList::unsafe_push_last(message *m) {
   m->next = nullptr; // sanity
-  if (empty()) {
-    first = m;
-    last = m;
+  destQueue &q = queueOf(m->destHost);
+  size++;
+  if (!q.first) {
+    q.first = m;
+    q.last = m;
     return;
   }
-  last->next = m;
-  last = m;
+  q.last->next = m;
+  q.last = m;
 }
 
 void PendingList::push_last(message *m) {
@@ -30,89 +56,207 @@ void PendingList::push_last(message *m) {
   mut.unlock();
 }
 
-int PendingList::remove_instances(const std::string str) {
+void PendingList::heardFrom(const Parser::Host *h) {
+  mut.lock();
+  queueOf(h).lastHeard = std::chrono::steady_clock::now();
+  mut.unlock();
+}
+
+std::vector<bool> PendingList::silent(std::chrono::milliseconds d) {
+  std::vector<bool> hosts;
+  hosts.reserve(queues.size());
+  mut.lock();
+  auto now = std::chrono::steady_clock::now();
+  for (auto &q : queues) {
+    hosts.push_back(now - q.lastHeard > d);
+  }
+  mut.unlock();
+  return hosts;
+}
+
+int PendingList::remove_instances(
+    const Parser::Host *dest, char type, const std::string str,
+    std::function<void(const message *)> onRemove) {
+  // onRemove sees each removed message before it is deleted
+  std::function<bool(const message *)> pred = [type, &str, &onRemove](
+                                                  const message *m) {
+    if (m->type != type || m->msg != str) {
+      return false;
+    }
+    if (onRemove) {
+      onRemove(m);
+    }
+    return true;
+  };
+  mut.lock();
+  int nb = removeFrom(queueOf(dest), pred);
+  mut.unlock();
+  return nb;
+}
+
+int PendingList::remove_if(std::function<bool(const message *)> pred) {
   int nb = 0;
   mut.lock();
-  if (empty()) {
-    mut.unlock();
+  for (auto &q : queues) {
+    nb += removeFrom(q, pred);
+  }
+  mut.unlock();
+  return nb;
+}
+
+int PendingList::remove_heads(std::function<bool(const message *)> pred) {
+  int nb = 0;
+  mut.lock();
+  for (auto &q : queues) {
+    while (q.first && pred(q.first)) {
+      message *head = q.first;
+      q.first = head->next;
+      delete head;
+      nb++;
+      size--;
+    }
+    if (!q.first) {
+      q.last = nullptr;
+    }
+  }
+  mut.unlock();
+  return nb;
+}
+
+int PendingList::removeFrom(destQueue &q,
+                            std::function<bool(const message *)> &pred) {
+  // Not thread-safe!
+  int nb = 0;
+  if (!q.first) {
     return nb;
   }
   message *prev;
-  while (first->msg == str) {
-    prev = first;
-    first = first->next;
+  while (pred(q.first)) {
+    prev = q.first;
+    q.first = q.first->next;
     delete prev;
     nb++;
-    if (!first) {
-      last = nullptr; // we removed the whole list
-      mut.unlock();
+    size--;
+    if (!q.first) {
+      q.last = nullptr; // we removed the whole list
       return nb;
     }
   }
-  message *current = first->next;
-  prev = first;
+  message *current = q.first->next;
+  prev = q.first;
   while (current) {
-    if (current->msg == str) {
+    if (pred(current)) {
       prev->next = current->next;
-      if (current == last) { // we removed the last element
-        last = prev;
+      if (current == q.last) { // we removed the last element
+        q.last = prev;
       }
       delete current;
       nb++;
+      size--;
     } else {
       prev = current;
     }
     current = prev->next;
   }
-  mut.unlock();
   return nb;
 }
 
 message *PendingList::pop() {
   mut.lock();
-  if (empty()) {
+  if (size == 0) {
     mut.unlock();
     return nullptr;
   }
-  message *prev = first;
-  if (first == last) { // only one element
-    last = nullptr;
-    first = nullptr;
-  } else {
-    first = first->next;
+  auto now = std::chrono::steady_clock::now();
+  while (true) {
+    destQueue &q = queues[cursor];
+    if (q.first && q.deficit >= q.first->len) {
+      message *prev = q.first;
+      q.deficit -= prev->len;
+      q.first = prev->next;
+      if (!q.first) { // only one element
+        q.last = nullptr;
+        q.deficit = 0;
+      }
+      size--;
+      mut.unlock();
+      return prev;
+    }
+    // Out of credit: visit the next destination
+    if (!q.first) {
+      q.deficit = 0;
+    }
+    cursor = (cursor + 1) % queues.size();
+    destQueue &next = queues[cursor];
+    if (next.first) {
+      next.deficit += quantum(next, now);
+    }
+  }
+}
+
+message *PendingList::pop_for(const Parser::Host *dest, size_t maxLen,
+                               bool &full) {
+  mut.lock();
+  destQueue &q = queueOf(dest);
+  message *m = q.first;
+  // Charged like pop(): an unresponsive destination's small quantum also
+  // bounds how much of a packet it gets
+  full = m && (m->len > maxLen || q.deficit < m->len);
+  if (!m || full) {
+    mut.unlock();
+    return nullptr;
+  }
+  q.deficit -= m->len;
+  q.first = m->next;
+  if (!q.first) {
+    q.last = nullptr;
+    q.deficit = 0;
   }
+  size--;
   mut.unlock();
-  return prev;
+  return m;
 }
 
-bool PendingList::empty() { return first == nullptr; }
+size_t PendingList::depth() {
+  mut.lock();
+  size_t n = size;
+  mut.unlock();
+  return n;
+}
 
 std::ostream &PendingList::display(std::ostream &out) {
   mut.lock();
-  message *current = first;
-  while (current) {
-    out << "|to:" << current->destHost->fullAddressReadable()
-        << (current->ack ? " a" : " b") << "\"" << current->msg << "\"["
-        << std::to_string(current->len) << "]|";
-    if (current != last) {
-      out << "->";
+  for (auto &q : queues) {
+    message *current = q.first;
+    while (current) {
+      out << "|to:" << current->destHost->fullAddressReadable() << " "
+          << current->type << "\"" << current->msg << "\"["
+          << std::to_string(current->len) << "]|";
+      if (current != q.last) {
+        out << "->";
+      }
+      current = current->next;
+    }
+    if (q.first) {
+      out << "\n";
     }
-    current = current->next;
   }
   mut.unlock();
   return out;
 }
 
 PendingList::~PendingList() {
-  message *current = first;
-  message *prev;
-  while (current) {
-    prev = current;
-    current = current->next;
-    delete prev;
+  for (auto &q : queues) {
+    message *current = q.first;
+    message *prev;
+    while (current) {
+      prev = current;
+      current = current->next;
+      delete prev;
+    }
   }
 }
 
 std::ostream &operator<<(std::ostream &out, PendingList &pend) {
   return pend.display(out);
-}
\ No newline at end of file
+}
@@ -0,0 +1,113 @@
+#include <climits>
+#include <fcntl.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "proposals.hpp"
+
+void ProposalReader::open(const char *configPath) {
+  path = configPath;
+  int fd = ::open(configPath, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    std::ostringstream os;
+    os << "`" << path << "` does not exist.";
+    throw std::invalid_argument(os.str());
+  }
+  size = static_cast<size_t>(st.st_size);
+  if (size > 0) {
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Could not map `" + path + "`");
+    }
+    data = static_cast<const char *>(addr);
+    madvise(const_cast<char *>(data), size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  cur = data;
+  end = data + size;
+
+  // Header: number of proposals, max proposal size, distinct values
+  if (!number(nb_proposals, ULONG_MAX) ||
+      !number(max_proposal_size, ULONG_MAX) ||
+      !number(distinct_values, ULONG_MAX)) {
+    fail();
+  }
+}
+
+void ProposalReader::fail() const {
+  unsigned long line = 1;
+  for (const char *c = data; c < cur && c < end; c++) {
+    line += *c == '\n';
+  }
+  std::ostringstream os;
+  os << "Parsing for `" << path << "` failed at line " << line;
+  throw std::invalid_argument(os.str());
+}
+
+bool ProposalReader::number(unsigned long &value, unsigned long max) {
+  // Skips blanks but not newlines: false at the end of the line, throws on
+  // anything but a number no greater than max
+  while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r')) {
+    cur++;
+  }
+  if (cur == end || *cur == '\n') {
+    return false;
+  }
+  if (*cur < '0' || *cur > '9') {
+    fail();
+  }
+  value = 0;
+  while (cur < end && *cur >= '0' && *cur <= '9') {
+    unsigned long digit = static_cast<unsigned long>(*cur - '0');
+    if (value > (max - digit) / 10) {
+      fail();
+    }
+    value = value * 10 + digit;
+    cur++;
+  }
+  if (cur < end && *cur != ' ' && *cur != '\t' && *cur != '\r' &&
+      *cur != '\n') {
+    fail();
+  }
+  return true;
+}
+
+bool ProposalReader::next(std::vector<uint32_t> &proposal) {
+  // Move to the next line
+  while (cur < end && *cur != '\n') {
+    cur++;
+  }
+  if (cur < end) {
+    cur++;
+  }
+  if (cur == end || slot == nb_proposals) {
+    return false;
+  }
+  slot++;
+
+  proposal.clear();
+  proposal.reserve(max_proposal_size);
+  unsigned long value;
+  while (number(value, UINT32_MAX)) {
+    if (proposal.size() == max_proposal_size) {
+      fail();
+    }
+    proposal.push_back(static_cast<uint32_t>(value));
+  }
+  return true;
+}
+
+ProposalReader::~ProposalReader() {
+  if (data) {
+    munmap(const_cast<char *>(data), size);
+  }
+}
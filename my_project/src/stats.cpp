@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+#include "stats.hpp"
+
+size_t LogHistogram::bucketOf(uint64_t v) {
+  if (v < (1UL << HIST_SUB_BITS)) {
+    return v; // linear below the first power of two
+  }
+  unsigned msb = 63U - static_cast<unsigned>(__builtin_clzll(v));
+  unsigned shift = msb - HIST_SUB_BITS;
+  size_t sub = (v >> shift) & ((1UL << HIST_SUB_BITS) - 1);
+  return ((shift + 1) << HIST_SUB_BITS) + sub;
+}
+
+uint64_t LogHistogram::bucketValue(size_t b) {
+  // Lowest value of the bucket
+  if (b < (1UL << HIST_SUB_BITS)) {
+    return b;
+  }
+  size_t shift = (b >> HIST_SUB_BITS) - 1;
+  uint64_t sub = b & ((1UL << HIST_SUB_BITS) - 1);
+  return ((1UL << HIST_SUB_BITS) + sub) << shift;
+}
+
+void LogHistogram::addTo(uint64_t *out) const {
+  for (size_t b = 0; b < HIST_BUCKETS; b++) {
+    out[b] += counts[b].load(relaxed);
+  }
+}
+
+LatencyStats::threadStats LatencyStats::slots[STATS_MAX_THREADS];
+std::atomic<size_t> LatencyStats::nbSlots(0);
+
+LatencyStats::threadStats &LatencyStats::local() {
+  // Extra threads share the last slot, updates stay atomic
+  static thread_local threadStats *mine = nullptr;
+  if (!mine) {
+    size_t idx = nbSlots.fetch_add(1);
+    mine = &slots[idx < STATS_MAX_THREADS ? idx : STATS_MAX_THREADS - 1];
+  }
+  return *mine;
+}
+
+uint64_t LatencyStats::now() {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch());
+  return static_cast<uint64_t>(us.count()) + 1;
+}
+
+void LatencyStats::recordAck(uint64_t firstSent,
+                             unsigned long retransmissions) {
+  if (!firstSent) {
+    return; // acked before we sent it: nothing to measure
+  }
+  threadStats &s = local();
+  s.ackLatency.record(now() - firstSent);
+  s.retransmissions.record(retransmissions);
+}
+
+void LatencyStats::recordDelivery(uint64_t broadcast) {
+  local().deliverLatency.record(now() - broadcast);
+}
+
+void LatencyStats::reportOne(std::ostream &out, const char *name,
+                             const LogHistogram threadStats::*hist) {
+  uint64_t merged[HIST_BUCKETS] = {};
+  size_t n = std::min<size_t>(nbSlots.load(), STATS_MAX_THREADS);
+  for (size_t i = 0; i < n; i++) {
+    (slots[i].*hist).addTo(merged);
+  }
+  uint64_t total = 0;
+  for (size_t b = 0; b < HIST_BUCKETS; b++) {
+    total += merged[b];
+  }
+  out << std::left << std::setw(24) << name << " n=" << total;
+  if (total == 0) {
+    out << "\n";
+    return;
+  }
+
+  const double percentiles[] = {50, 90, 99, 99.9, 100};
+  const char *labels[] = {"p50", "p90", "p99", "p99.9", "max"};
+  size_t p = 0;
+  uint64_t seen = 0;
+  for (size_t b = 0; b < HIST_BUCKETS && p < 5; b++) {
+    seen += merged[b];
+    while (p < 5 && static_cast<double>(seen) >=
+                        percentiles[p] / 100 * static_cast<double>(total)) {
+      out << " " << labels[p] << "=" << LogHistogram::bucketValue(b);
+      p++;
+    }
+  }
+  out << "\n";
+}
+
+void LatencyStats::report(std::ostream &out) {
+  reportOne(out, "ack latency (us)", &threadStats::ackLatency);
+  reportOne(out, "retransmissions", &threadStats::retransmissions);
+  reportOne(out, "deliver latency (us)", &threadStats::deliverLatency);
+  out.flush();
+}
@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.hpp"
+
+// stdio buffer of the trace file
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+void PacketTrace::openWrite(const char *path) {
+  if (!(file = fopen(path, "wb"))) {
+    perror("trace file creation failed");
+    exit(EXIT_FAILURE);
+  }
+  setvbuf(file, nullptr, _IOFBF, TRACE_BUFFER_SIZE);
+}
+
+void PacketTrace::openRead(const char *path) {
+  if (!(file = fopen(path, "rb"))) {
+    perror("trace file opening failed");
+    exit(EXIT_FAILURE);
+  }
+  setvbuf(file, nullptr, _IOFBF, TRACE_BUFFER_SIZE);
+}
+
+void PacketTrace::record(const sockaddr_in &from, const char *buffer,
+                         size_t len) {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  traceRecord rec;
+  rec.timestamp = static_cast<uint64_t>(ts.tv_sec) * 1000000000UL +
+                  static_cast<uint64_t>(ts.tv_nsec);
+  rec.ip = from.sin_addr.s_addr;
+  rec.port = from.sin_port;
+  rec.len = static_cast<uint16_t>(len);
+  mut.lock();
+  fwrite(&rec, sizeof(rec), 1, file);
+  fwrite(buffer, 1, len, file);
+  mut.unlock();
+}
+
+bool PacketTrace::next(traceRecord &rec, char *buffer, size_t maxLen) {
+  if (fread(&rec, sizeof(rec), 1, file) != 1) {
+    return false;
+  }
+  if (rec.len > maxLen) {
+    fprintf(stderr, "Trace record too long, stopping replay\n");
+    return false;
+  }
+  return fread(buffer, 1, rec.len, file) == rec.len;
+}
+
+void PacketTrace::close() {
+  mut.lock();
+  if (file) {
+    fclose(file);
+    file = nullptr;
+  }
+  mut.unlock();
+}
+
+PacketTrace::~PacketTrace() { close(); }
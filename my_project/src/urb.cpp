@@ -0,0 +1,420 @@
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+#include "defines.hpp"
+#include "messaging.hpp"
+#include "stats.hpp"
+#include "urb.hpp"
+
+URB::URB(std::vector<Parser::Host> &hosts, Parser::Host *self,
+         PendingList &pending, OutputFile *logFile, std::mutex &logMutex,
+         unsigned long nbMessages, bool relay)
+    : hosts(hosts), self(self), pending(pending), logFile(logFile),
+      logMutex(logMutex), nbMessages(nbMessages), lastBroadcast(0),
+      origins(hosts.size()), watermarks(hosts.size(), hosts.size()),
+      relay(relay), dirty(false),
+      seenFrom(hosts.size(), hosts.size()),
+      sentVersion(hosts.size(), hosts.size()), summariesQueued(hosts.size()),
+      resent(hosts.size(), hosts.size()), watermarksQueued(hosts.size()),
+      mut() {
+  for (auto &o : origins) {
+    o.delivered = 0;
+    o.stable = 0;
+    o.version = 0;
+  }
+  for (auto &q : summariesQueued) {
+    q = 0;
+  }
+  for (auto &q : watermarksQueued) {
+    q = 0;
+  }
+}
+
+void URB::broadcast() {
+  mut.lock();
+  unsafe_broadcast();
+  mut.unlock();
+}
+
+void URB::unsafe_broadcast() {
+  size_t me = self->id - 1;
+  while (lastBroadcast < nbMessages &&
+         lastBroadcast - origins[me].delivered < URB_WINDOW) {
+    lastBroadcast++;
+    logMutex.lock();
+    logFile->writeLine("b " + std::to_string(lastBroadcast));
+    logMutex.unlock();
+    ack(me, lastBroadcast, self);
+  }
+}
+
+void URB::sendWatermarks() {
+  mut.lock();
+  int nb = collect();
+  // Not on the UDPSocket pipeline, so traced with its default policy
+  DefaultInstrumentation::log([nb] {
+    return "[URB] Collected " + std::to_string(nb) + " pending messages";
+  });
+  std::vector<std::string> chunks;
+  for (size_t start = 0; start < origins.size();
+       start += URB_WATERMARKS_PER_PACKET) {
+    std::string chunk = std::to_string(start + 1);
+    size_t end = std::min(start + URB_WATERMARKS_PER_PACKET, origins.size());
+    for (size_t o = start; o < end; o++) {
+      chunk += " " + std::to_string(origins[o].delivered);
+    }
+    chunks.push_back(chunk);
+  }
+  mut.unlock();
+
+  for (auto &h : hosts) {
+    // Still queued (e.g. it crashed): receivers keep the highest watermarks,
+    // so the next period's set replaces this one as well
+    auto &queued = watermarksQueued[h.id - 1];
+    if (&h == self || queued > 0) {
+      continue;
+    }
+    queued += chunks.size();
+    for (auto &chunk : chunks) {
+      message *m = new message{&h, chunk, chunk.length() + 1, MSG_WATERMARK};
+      m->outstanding = &queued;
+      pending.push(m);
+    }
+  }
+}
+
+std::string URB::summaryToken(size_t o) {
+  originState &st = origins[o];
+  // Contiguous seen prefix, then bit i of the extras is seq + 2 + i
+  unsigned long seq = st.delivered;
+  auto it = st.inflight.upper_bound(seq);
+  for (; it != st.inflight.end() && it->first == seq + 1; ++it) {
+    seq++;
+  }
+  std::string bits;
+  for (; it != st.inflight.end() && it->first < seq + 2 + URB_WINDOW; ++it) {
+    size_t i = it->first - seq - 2;
+    if (bits.size() <= i / 4) {
+      bits.resize(i / 4 + 1, 0);
+    }
+    bits[i / 4] = static_cast<char>(bits[i / 4] | (1 << (i % 4)));
+  }
+  if (seq == st.stable && bits.empty()) {
+    return ""; // everyone has all of it
+  }
+  std::string token = std::to_string(o + 1) + ":" + std::to_string(seq);
+  if (!bits.empty()) {
+    token += ":";
+    for (char nibble : bits) {
+      token += "0123456789abcdef"[static_cast<size_t>(nibble)];
+    }
+  }
+  return token;
+}
+
+void URB::sendSummaries(bool force) {
+  std::vector<std::pair<Parser::Host *, std::vector<std::string>>> out;
+  mut.lock();
+  if (!dirty && !force) {
+    mut.unlock();
+    return;
+  }
+  dirty = false;
+  if (force) {
+    // Periodic full resend, covers lost summaries
+    for (size_t h = 0; h < hosts.size(); h++) {
+      for (size_t o = 0; o < origins.size(); o++) {
+        sentVersion[h][o] = ULONG_MAX;
+      }
+    }
+  }
+
+  std::vector<std::string> tokens(origins.size());
+  std::vector<bool> built(origins.size(), false);
+  for (size_t h = 0; h < hosts.size(); h++) {
+    if (&hosts[h] == self) {
+      continue;
+    }
+    auto sent = sentVersion[h];
+    size_t o = 0;
+    while (o < origins.size() && sent[o] == origins[o].version) {
+      o++;
+    }
+    if (o == origins.size()) {
+      continue; // nothing new for this peer
+    }
+    if (summariesQueued[h] > 0) {
+      dirty = true; // its last summaries are not sent yet: next period
+      continue;
+    }
+    std::vector<std::string> chunks;
+    std::string chunk;
+    for (; o < origins.size(); o++) {
+      if (sent[o] == origins[o].version) {
+        continue;
+      }
+      sent[o] = origins[o].version;
+      if (!built[o]) {
+        tokens[o] = summaryToken(o);
+        built[o] = true;
+      }
+      const std::string &token = tokens[o];
+      if (token.empty()) {
+        continue;
+      }
+      if (!chunk.empty() &&
+          chunk.length() + token.length() >= URB_SUMMARY_BYTES) {
+        chunks.push_back(chunk);
+        chunk.clear();
+      }
+      chunk += chunk.empty() ? token : " " + token;
+    }
+    if (!chunk.empty()) {
+      chunks.push_back(chunk);
+    }
+    summariesQueued[h] += chunks.size();
+    out.emplace_back(&hosts[h], std::move(chunks));
+  }
+  mut.unlock();
+
+  for (auto &peer : out) {
+    for (auto &c : peer.second) {
+      message *m = new message{peer.first, c, c.length() + 1, MSG_SEEN};
+      m->outstanding = &summariesQueued[peer.first->id - 1];
+      pending.push(m);
+    }
+  }
+}
+
+bool URB::receive(Parser::Host *from, const std::string &msg) {
+  unsigned long origin, seq;
+  if (sscanf(msg.c_str(), "%lu %lu", &origin, &seq) != 2 || origin < 1 ||
+      origin > origins.size()) {
+    return false;
+  }
+  mut.lock();
+  ack(origin - 1, seq, from);
+  mut.unlock();
+  return true;
+}
+
+void URB::receiveWatermarks(Parser::Host *from, const std::string &msg) {
+  std::istringstream iss(msg);
+  size_t origin;
+  unsigned long wm;
+  if (!(iss >> origin) || origin < 1) {
+    return;
+  }
+  mut.lock();
+  auto fromWatermarks = watermarks[from->id - 1];
+  size_t o = origin - 1;
+  for (; o < origins.size() && iss >> wm; o++) {
+    fromWatermarks[o] = std::max(fromWatermarks[o], wm);
+  }
+  catchUp(from, origin - 1, o);
+  mut.unlock();
+}
+
+void URB::catchUp(Parser::Host *h, size_t first, size_t last) {
+  // Not thread-safe! Origins [first, last) where `h` lags behind `stable`,
+  // possible only if it was silent while we collected
+  auto wms = watermarks[h->id - 1];
+  auto hResent = resent[h->id - 1];
+  std::vector<std::string> chunks;
+  std::string chunk;
+  for (size_t o = first; o < last; o++) {
+    unsigned long upTo = std::min(origins[o].stable, wms[o] + URB_WINDOW);
+    if (wms[o] >= upTo) {
+      continue;
+    }
+    if (relay) {
+      // A summary acks and disseminates the whole prefix at once
+      std::string token = std::to_string(o + 1) + ":" + std::to_string(upTo);
+      if (!chunk.empty() &&
+          chunk.length() + token.length() >= URB_SUMMARY_BYTES) {
+        chunks.push_back(chunk);
+        chunk.clear();
+      }
+      chunk += chunk.empty() ? token : " " + token;
+      continue;
+    }
+    for (unsigned long seq = std::max(wms[o], hResent[o]) + 1; seq <= upTo;
+         seq++) {
+      pushRelay(h, o, seq);
+    }
+    hResent[o] = std::max(hResent[o], upTo);
+  }
+  if (!chunk.empty()) {
+    chunks.push_back(chunk);
+  }
+  for (auto &c : chunks) {
+    pending.push(new message{h, c, c.length() + 1, MSG_SEEN});
+  }
+}
+
+bool URB::receiveSummary(Parser::Host *from, const std::string &msg) {
+  std::istringstream iss(msg);
+  std::string token;
+  bool wellFormed = true;
+  mut.lock();
+  auto fromSeen = seenFrom[from->id - 1];
+  while (iss >> token) {
+    unsigned long origin, seq;
+    int n = 0;
+    if (sscanf(token.c_str(), "%lu:%lu%n", &origin, &seq, &n) != 2 ||
+        origin < 1 || origin > origins.size()) {
+      wellFormed = false;
+      continue;
+    }
+    size_t o = origin - 1;
+    // Origins broadcast at their own pace, the bound is relative to ours
+    unsigned long limit = origins[o].delivered + URB_SEEN_AHEAD;
+    bool clamped = seq > limit;
+    seq = std::min(seq, limit);
+    // Prefix: only what this peer did not already report
+    for (unsigned long s = std::max(fromSeen[o], origins[o].stable) + 1;
+         s <= seq; s++) {
+      ack(o, s, from);
+    }
+    fromSeen[o] = std::max(fromSeen[o], seq);
+    if (clamped || token[size_t(n)] != ':') {
+      continue;
+    }
+    for (size_t d = size_t(n) + 1; d < token.length(); d++) {
+      if (!isdigit(static_cast<unsigned char>(token[d])) &&
+          (token[d] < 'a' || token[d] > 'f')) {
+        wellFormed = false;
+        break;
+      }
+      int nibble = isdigit(static_cast<unsigned char>(token[d]))
+                       ? token[d] - '0'
+                       : token[d] - 'a' + 10;
+      for (int b = 0; b < 4; b++) {
+        unsigned long s = seq + 2 + 4 * (d - size_t(n) - 1) + size_t(b);
+        if ((nibble >> b) & 1 && s <= limit) {
+          ack(o, s, from);
+        }
+      }
+    }
+  }
+  mut.unlock();
+  return wellFormed;
+}
+
+URB::entry &URB::track(size_t origin, unsigned long seq) {
+  auto &inflight = origins[origin].inflight;
+  auto it = inflight.find(seq);
+  if (it != inflight.end()) {
+    return it->second;
+  }
+  entry &e = inflight[seq];
+  e.acks.assign(hosts.size(), false);
+  e.acks[self->id - 1] = true;
+  e.nbAcks = 1;
+  e.delivered = false;
+  e.broadcastTime = origin == self->id - 1 ? LatencyStats::now() : 0;
+
+  origins[origin].version++;
+
+  // First time we see it: relay to everyone
+  if (relay) {
+    dirty = true; // in the next summaries
+    return e;
+  }
+  for (auto &h : hosts) {
+    if (&h != self) {
+      pushRelay(&h, origin, seq);
+    }
+  }
+  return e;
+}
+
+void URB::pushRelay(Parser::Host *h, size_t origin, unsigned long seq) {
+  std::string text = std::to_string(origin + 1) + " " + std::to_string(seq);
+  message *m = new message{h, text, text.length() + 1};
+  m->origin = origin + 1;
+  m->seq = seq;
+  pending.push_last(m);
+}
+
+void URB::ack(size_t origin, unsigned long seq, const Parser::Host *from) {
+  originState &o = origins[origin];
+  if (seq <= o.stable) {
+    return; // already delivered everywhere, state is gone
+  }
+  entry &e = track(origin, seq);
+  if (!e.acks[from->id - 1]) {
+    e.acks[from->id - 1] = true;
+    e.nbAcks++;
+  }
+  if (e.delivered || e.nbAcks <= hosts.size() / 2) {
+    return;
+  }
+  e.delivered = true;
+
+  // FIFO delivery of the contiguous URB-delivered prefix
+  bool advanced = false;
+  for (auto it = o.inflight.find(o.delivered + 1);
+       it != o.inflight.end() && it->first == o.delivered + 1 &&
+       it->second.delivered;
+       ++it) {
+    o.delivered++;
+    advanced = true;
+    if (it->second.broadcastTime) {
+      LatencyStats::recordDelivery(it->second.broadcastTime);
+    }
+    logMutex.lock();
+    logFile->writeLine("d " + std::to_string(origin + 1) + " " +
+                       std::to_string(o.delivered));
+    logMutex.unlock();
+  }
+  if (advanced && origin == self->id - 1) {
+    unsafe_broadcast();
+  }
+}
+
+int URB::collect() {
+  size_t me = self->id - 1;
+  std::vector<bool> silent =
+      pending.silent(std::chrono::milliseconds(URB_SILENT_MS));
+  silent[me] = false;
+  for (size_t h = 0; h < hosts.size(); h++) {
+    if (silent[h]) {
+      // Regenerated again from its watermark if it comes back
+      for (size_t o = 0; o < origins.size(); o++) {
+        resent[h][o] = watermarks[h][o];
+      }
+    }
+  }
+  bool changed = false;
+  for (size_t o = 0; o < origins.size(); o++) {
+    unsigned long wm = origins[o].delivered;
+    for (size_t h = 0; h < hosts.size(); h++) {
+      if (h != me && !silent[h]) {
+        wm = std::min(wm, watermarks[h][o]);
+      }
+    }
+    if (wm > origins[o].stable) {
+      auto &inflight = origins[o].inflight;
+      inflight.erase(inflight.begin(), inflight.upper_bound(wm));
+      origins[o].stable = wm;
+      changed = true;
+    }
+  }
+  if (!changed) {
+    return 0;
+  }
+
+  // Retransmissions of stable messages are useless: their destination
+  // delivered them, or is silent and gets them regenerated if it comes back
+  return pending.remove_if([this, &silent](const message *m) {
+    size_t dest = m->destHost->id - 1;
+    return m->seq && m->seq <= origins[m->origin - 1].stable &&
+           (silent[dest] || m->seq <= watermarks[dest][m->origin - 1]);
+  });
+}
@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.hpp"
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+// Multishot recvmsg and provided buffer rings appeared in Linux 6.0
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+#define URING_SUPPORTED 1
+#else
+#define URING_SUPPORTED 0
+#endif
+
+#if URING_SUPPORTED
+
+// user_data of the multishot receive and of its cancellation, sends use
+// their slot index
+#define RECV_TAG UINT64_MAX
+#define CANCEL_TAG (UINT64_MAX - 1)
+#define BUFFER_GROUP 0
+
+struct sendSlot {
+  msghdr hdr;
+  iovec iov;
+  sockaddr_in addr;
+};
+
+struct UringTransport::ringState {
+  int fd;
+  int sockfd;
+  void *rings;
+  size_t ringsSize;
+  io_uring_sqe *sqes;
+  size_t sqesSize;
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+  unsigned sqEntries;
+  unsigned *cqHead, *cqTail, *cqMask;
+  io_uring_cqe *cqes;
+  io_uring_buf_ring *bufRing;
+  uint16_t bufTail;
+  char *recvArena;
+  msghdr recvHdr;
+  char *sendArena;
+  std::vector<sendSlot> slots;
+  std::vector<unsigned> freeSlots;
+  unsigned unsubmitted;
+  std::atomic_bool recvArmed; // a multishot receive is queued or running
+};
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                      unsigned flags, void *arg, size_t argSize) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit,
+                                  minComplete, flags, arg, argSize));
+}
+
+static void *mapAnonymous(size_t size) {
+  void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return p == MAP_FAILED ? nullptr : p;
+}
+
+// Waits up to `nsec` for a completion, which also runs task work
+static void waitCompletion(int fd, long nsec) {
+  __kernel_timespec ts;
+  ts.tv_sec = 0;
+  ts.tv_nsec = nsec;
+  io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.ts = reinterpret_cast<uint64_t>(&ts);
+  uringEnter(fd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+             sizeof(arg));
+}
+
+template <typename T> static T *at(void *base, unsigned offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+// Entry of the provided buffer ring
+// Not through io_uring_buf_ring::bufs: in C++ its empty wrapper member takes
+// a byte and shifts the array
+static io_uring_buf *bufEntry(io_uring_buf_ring *ring, uint16_t idx) {
+  return reinterpret_cast<io_uring_buf *>(ring) +
+         (idx & (URING_RECV_BUFFERS - 1));
+}
+
+bool UringTransport::init(int sockfd) {
+  ring = new ringState();
+  ringState *r = ring;
+  r->fd = -1;
+  r->sockfd = sockfd;
+
+  io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = 4 * URING_ENTRIES;
+  r->fd = static_cast<int>(syscall(__NR_io_uring_setup, URING_ENTRIES, &p));
+  if (r->fd < 0 || !(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(p.features & IORING_FEAT_EXT_ARG)) {
+    return false;
+  }
+
+  // Both rings share one mapping, SQEs have their own
+  r->ringsSize = std::max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                          p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+  void *rings = mmap(nullptr, r->ringsSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  r->sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = mmap(nullptr, r->sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  r->rings = rings == MAP_FAILED ? nullptr : rings;
+  r->sqes = sqes == MAP_FAILED ? nullptr : static_cast<io_uring_sqe *>(sqes);
+  if (!r->rings || !r->sqes) {
+    return false;
+  }
+  r->sqHead = at<unsigned>(rings, p.sq_off.head);
+  r->sqTail = at<unsigned>(rings, p.sq_off.tail);
+  r->sqMask = at<unsigned>(rings, p.sq_off.ring_mask);
+  r->sqArray = at<unsigned>(rings, p.sq_off.array);
+  r->sqEntries = p.sq_entries;
+  r->cqHead = at<unsigned>(rings, p.cq_off.head);
+  r->cqTail = at<unsigned>(rings, p.cq_off.tail);
+  r->cqMask = at<unsigned>(rings, p.cq_off.ring_mask);
+  r->cqes = at<io_uring_cqe>(rings, p.cq_off.cqes);
+
+  // Provided receive buffers, registered once and recycled by recv()
+  r->bufRing = static_cast<io_uring_buf_ring *>(
+      mapAnonymous(URING_RECV_BUFFERS * sizeof(io_uring_buf)));
+  r->recvArena =
+      static_cast<char *>(mapAnonymous(URING_RECV_BUFFERS * URING_BUFFER_SIZE));
+  r->sendArena =
+      static_cast<char *>(mapAnonymous(URING_SEND_SLOTS * URING_BUFFER_SIZE));
+  if (!r->bufRing || !r->recvArena || !r->sendArena) {
+    return false;
+  }
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(r->bufRing);
+  reg.ring_entries = URING_RECV_BUFFERS;
+  reg.bgid = BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg,
+              1) < 0) {
+    return false;
+  }
+  r->bufTail = 0;
+  for (uint16_t bid = 0; bid < URING_RECV_BUFFERS; bid++) {
+    io_uring_buf *b = bufEntry(r->bufRing, r->bufTail);
+    b->addr = reinterpret_cast<uint64_t>(r->recvArena + bid * URING_BUFFER_SIZE);
+    b->len = URING_BUFFER_SIZE;
+    b->bid = bid;
+    r->bufTail++;
+  }
+  __atomic_store_n(&r->bufRing->tail, r->bufTail, __ATOMIC_RELEASE);
+
+  memset(&r->recvHdr, 0, sizeof(r->recvHdr));
+  r->recvHdr.msg_namelen = sizeof(sockaddr_in);
+
+  r->slots.resize(URING_SEND_SLOTS);
+  for (unsigned i = 0; i < URING_SEND_SLOTS; i++) {
+    r->freeSlots.push_back(i);
+  }
+  r->unsubmitted = 0;
+
+  sqMut.lock();
+  bool armed = armRecv() && r->unsubmitted == 0;
+  sqMut.unlock();
+  r->recvArmed = armed;
+  // Kernels without multishot recvmsg (before 6.0) fail it at submission
+  if (armed && __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE) != *r->cqHead) {
+    io_uring_cqe &cqe = r->cqes[*r->cqHead & *r->cqMask];
+    if (cqe.user_data == RECV_TAG && cqe.res < 0 &&
+        !(cqe.flags & IORING_CQE_F_MORE)) {
+      return false;
+    }
+  }
+  return armed;
+}
+
+bool UringTransport::armRecv() {
+  // Not thread-safe! True once queued, flushes submit it
+  ringState *r = ring;
+  unsigned tail = *r->sqTail;
+  if (tail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE) == r->sqEntries) {
+    unsafe_flush();
+    if (tail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE) == r->sqEntries) {
+      return false; // still full: retried at the next recv()
+    }
+  }
+  unsigned idx = tail & *r->sqMask;
+  io_uring_sqe *sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = r->sockfd;
+  sqe->addr = reinterpret_cast<uint64_t>(&r->recvHdr);
+  sqe->len = 1;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->user_data = RECV_TAG;
+  r->sqArray[idx] = idx;
+  __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+  r->unsubmitted++;
+  unsafe_flush();
+  return true;
+}
+
+void UringTransport::unsafe_flush() {
+  ringState *r = ring;
+  while (r->unsubmitted > 0) {
+    int ret = uringEnter(r->fd, r->unsubmitted, 0, 0, nullptr, 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return; // EAGAIN/EBUSY: retried at the next flush
+    }
+    r->unsubmitted -= static_cast<unsigned>(ret);
+  }
+}
+
+void UringTransport::flush() {
+  sqMut.lock();
+  unsafe_flush();
+  sqMut.unlock();
+}
+
+ssize_t UringTransport::send(const sockaddr_in *dest, const char *buffer,
+                             size_t len) {
+  ringState *r = ring;
+  if (len > URING_BUFFER_SIZE) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  slotMut.lock();
+  if (r->freeSlots.empty()) {
+    // Slots come back when listeners reap send completions
+    slotMut.unlock();
+    flush();
+    errno = EAGAIN;
+    return -1;
+  }
+  unsigned slot = r->freeSlots.back();
+  r->freeSlots.pop_back();
+  slotMut.unlock();
+
+  sendSlot &s = r->slots[slot];
+  char *data = r->sendArena + slot * URING_BUFFER_SIZE;
+  memcpy(data, buffer, len);
+  s.addr = *dest;
+  s.iov.iov_base = data;
+  s.iov.iov_len = len;
+  memset(&s.hdr, 0, sizeof(s.hdr));
+  s.hdr.msg_name = &s.addr;
+  s.hdr.msg_namelen = sizeof(s.addr);
+  s.hdr.msg_iov = &s.iov;
+  s.hdr.msg_iovlen = 1;
+
+  sqMut.lock();
+  unsigned tail = *r->sqTail;
+  if (tail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE) == r->sqEntries) {
+    unsafe_flush();
+    if (tail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE) == r->sqEntries) {
+      sqMut.unlock();
+      slotMut.lock();
+      r->freeSlots.push_back(slot);
+      slotMut.unlock();
+      errno = EAGAIN;
+      return -1;
+    }
+  }
+  unsigned idx = tail & *r->sqMask;
+  io_uring_sqe *sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = r->sockfd;
+  sqe->addr = reinterpret_cast<uint64_t>(&s.hdr);
+  sqe->len = 1;
+  sqe->user_data = slot;
+  r->sqArray[idx] = idx;
+  __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+  if (++r->unsubmitted >= URING_SEND_BATCH) {
+    unsafe_flush();
+  }
+  sqMut.unlock();
+  return static_cast<ssize_t>(len);
+}
+
+ssize_t UringTransport::recv(sockaddr_in &from, char *buffer, size_t len) {
+  ringState *r = ring;
+  bool rearm = false;
+  ssize_t ret = -1;
+  cqMut.lock();
+  unsigned head = *r->cqHead;
+  unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+  while (head != tail && ret < 0) {
+    io_uring_cqe cqe = r->cqes[head & *r->cqMask];
+    head++;
+    __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+
+    if (cqe.user_data != RECV_TAG) {
+      // Send completion: UDP errors are losses, the slot is free again
+      slotMut.lock();
+      r->freeSlots.push_back(static_cast<unsigned>(cqe.user_data));
+      slotMut.unlock();
+      continue;
+    }
+    if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP) {
+      recvSupported = false; // the socket goes back to recvfrom
+    }
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      rearm = true; // multishot ended (e.g. out of buffers)
+    }
+    if (cqe.res < 0 || !(cqe.flags & IORING_CQE_F_BUFFER)) {
+      continue;
+    }
+
+    uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    char *buf = r->recvArena + bid * URING_BUFFER_SIZE;
+    io_uring_recvmsg_out out;
+    memcpy(&out, buf, sizeof(out));
+    char *name = buf + sizeof(out);
+    char *payload = name + r->recvHdr.msg_namelen + r->recvHdr.msg_controllen;
+    size_t avail = URING_BUFFER_SIZE - static_cast<size_t>(payload - buf);
+    size_t n = std::min({static_cast<size_t>(out.payloadlen), avail, len});
+    memset(&from, 0, sizeof(from));
+    memcpy(&from, name, std::min<size_t>(out.namelen, sizeof(from)));
+    memcpy(buffer, payload, n);
+    ret = static_cast<ssize_t>(n);
+
+    // Give the buffer back to the kernel
+    io_uring_buf *b = bufEntry(r->bufRing, r->bufTail);
+    b->addr = reinterpret_cast<uint64_t>(buf);
+    b->len = URING_BUFFER_SIZE;
+    b->bid = bid;
+    r->bufTail++;
+    __atomic_store_n(&r->bufRing->tail, r->bufTail, __ATOMIC_RELEASE);
+  }
+  cqMut.unlock();
+
+  if (rearm) {
+    r->recvArmed = false;
+  }
+  if (!r->recvArmed && recvSupported) {
+    sqMut.lock();
+    if (!r->recvArmed) {
+      r->recvArmed = armRecv();
+    }
+    sqMut.unlock();
+  }
+  if (ret >= 0) {
+    return ret;
+  }
+
+  // Nothing ready: wait a little in the kernel
+  waitCompletion(r->fd, 1000000);
+  errno = EAGAIN;
+  return -1;
+}
+
+void UringTransport::drain() {
+  // Not thread-safe! Cancels the receive and reaps completions until the
+  // kernel is done with every request, as they point into our buffers
+  ringState *r = ring;
+  unsigned tail = *r->sqTail;
+  if (r->recvArmed &&
+      tail - __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE) < r->sqEntries) {
+    unsigned idx = tail & *r->sqMask;
+    io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = RECV_TAG;
+    sqe->user_data = CANCEL_TAG;
+    r->sqArray[idx] = idx;
+    __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+    r->unsubmitted++;
+  }
+  bool recvDone = !r->recvArmed;
+  for (int ms = 0; ms < URING_DRAIN_MS; ms++) {
+    unsafe_flush();
+    unsigned head = *r->cqHead;
+    unsigned cqTail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != cqTail; head++) {
+      io_uring_cqe &cqe = r->cqes[head & *r->cqMask];
+      if (cqe.user_data == RECV_TAG) {
+        recvDone = recvDone || !(cqe.flags & IORING_CQE_F_MORE);
+      } else if (cqe.user_data != CANCEL_TAG) {
+        r->freeSlots.push_back(static_cast<unsigned>(cqe.user_data));
+      }
+    }
+    __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+    // Sends never submitted hold their slot but are unknown to the kernel
+    if (recvDone && r->freeSlots.size() + r->unsubmitted >= r->slots.size()) {
+      return;
+    }
+    waitCompletion(r->fd, 1000000);
+  }
+}
+
+UringTransport::~UringTransport() {
+  ringState *r = ring;
+  if (!r) {
+    return;
+  }
+  // The kernel may still use our buffers: stop it before freeing them
+  if (r->rings && r->sqes) {
+    drain();
+  }
+  if (r->fd >= 0) {
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = BUFFER_GROUP;
+    syscall(__NR_io_uring_register, r->fd, IORING_UNREGISTER_PBUF_RING, &reg,
+            1);
+    close(r->fd);
+    r->fd = -1;
+  }
+  if (r->sendArena) {
+    munmap(r->sendArena, URING_SEND_SLOTS * URING_BUFFER_SIZE);
+  }
+  if (r->recvArena) {
+    munmap(r->recvArena, URING_RECV_BUFFERS * URING_BUFFER_SIZE);
+  }
+  if (r->bufRing) {
+    munmap(r->bufRing, URING_RECV_BUFFERS * sizeof(io_uring_buf));
+  }
+  if (r->sqes) {
+    munmap(r->sqes, r->sqesSize);
+  }
+  if (r->rings) {
+    munmap(r->rings, r->ringsSize);
+  }
+  delete r;
+}
+
+#else
+
+struct UringTransport::ringState {};
+
+bool UringTransport::init(int) { return false; }
+ssize_t UringTransport::send(const sockaddr_in *, const char *, size_t) {
+  errno = ENOSYS;
+  return -1;
+}
+ssize_t UringTransport::recv(sockaddr_in &, char *, size_t) {
+  errno = ENOSYS;
+  return -1;
+}
+void UringTransport::flush() {}
+void UringTransport::unsafe_flush() {}
+bool UringTransport::armRecv() { return false; }
+void UringTransport::drain() {}
+UringTransport::~UringTransport() { delete ring; }
+
+#endif
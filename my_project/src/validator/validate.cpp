@@ -0,0 +1,378 @@
+// Native validator of da_proc output files
+// Usage: da_validate perfect|fifo|lattice [--config CONFIG]...
+//                    [--duration SECONDS] OUTPUT...
+// The i-th OUTPUT is the output of process i. Perfect links need the run
+// config, lattice agreement needs one config per process (or a single one).
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+enum Mode { PerfectLinks, FIFOBroadcast, LatticeAgreement };
+
+// Read-only mapping of a whole file
+class MappedFile {
+public:
+  MappedFile() : data(nullptr), size(0) {}
+  bool open(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      ::close(fd);
+      return false;
+    }
+    size = static_cast<size_t>(st.st_size);
+    if (size > 0) {
+      void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        ::close(fd);
+        return false;
+      }
+      data = static_cast<const char *>(addr);
+      madvise(const_cast<char *>(data), size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+    return true;
+  }
+  ~MappedFile() {
+    if (data) {
+      munmap(const_cast<char *>(data), size);
+    }
+  }
+  const char *data;
+  size_t size;
+};
+
+// Line tokenizer over a mapped file
+// A NUL byte ends the data: it is the preallocated tail of a crashed process
+class LineReader {
+public:
+  LineReader(const MappedFile &f) : cur(f.data), end(f.data + f.size) {
+    const void *nul = f.data ? memchr(f.data, 0, f.size) : nullptr;
+    if (nul) {
+      end = static_cast<const char *>(nul);
+    }
+  }
+  bool nextLine() {
+    while (cur < end && *cur != '\n') {
+      cur++; // skip the rest of the current line
+    }
+    if (cur < end) {
+      cur++;
+    }
+    return cur < end;
+  }
+  bool first() const { return cur < end; }
+  char peek() {
+    skipBlanks();
+    return cur < end && *cur != '\n' ? *cur : 0;
+  }
+  void skip() { cur++; }
+  bool number(unsigned long &value) {
+    skipBlanks();
+    if (cur == end || *cur < '0' || *cur > '9') {
+      return false;
+    }
+    value = 0;
+    while (cur < end && *cur >= '0' && *cur <= '9') {
+      value = value * 10 + static_cast<unsigned long>(*cur - '0');
+      cur++;
+    }
+    return true;
+  }
+
+private:
+  const char *cur;
+  const char *end;
+  void skipBlanks() {
+    while (cur < end && (*cur == ' ' || *cur == '\t' || *cur == '\r')) {
+      cur++;
+    }
+  }
+};
+
+struct fileResult {
+  bool ok;
+  std::string error;
+  unsigned long broadcasts;
+  unsigned long deliveries;
+  std::vector<unsigned long> maxDelivered; // per sender, for cross-checks
+  std::vector<std::vector<unsigned long>> sets; // lattice: decisions/proposals
+};
+
+static void fail(fileResult &r, const std::string &file, unsigned long line,
+                 const std::string &what) {
+  r.ok = false;
+  r.error = "File " + file + ", Line " + std::to_string(line) + ": " + what;
+}
+
+// Broadcast and delivery events, shared by perfect links and FIFO
+static void checkEvents(const std::string &path, size_t nbProcs, bool fifo,
+                        fileResult &r) {
+  MappedFile f;
+  if (!f.open(path)) {
+    return fail(r, path, 0, "cannot be read");
+  }
+  r.maxDelivered.assign(nbProcs, 0);
+  std::vector<std::vector<bool>> seen(nbProcs); // perfect links only
+  LineReader in(f);
+  unsigned long lineNumber = 0;
+  for (bool more = in.first(); more; more = in.nextLine()) {
+    lineNumber++;
+    char kind = in.peek();
+    in.skip();
+    unsigned long sender, msg;
+    if (kind == 'b' && in.number(msg)) {
+      if (msg != r.broadcasts + 1) {
+        return fail(r, path, lineNumber,
+                    "Messages broadcast out of order. Expected message " +
+                        std::to_string(r.broadcasts + 1) +
+                        " but broadcast message " + std::to_string(msg));
+      }
+      r.broadcasts++;
+    } else if (kind == 'd' && in.number(sender) && in.number(msg)) {
+      if (sender < 1 || sender > nbProcs) {
+        return fail(r, path, lineNumber,
+                    "Unknown sender " + std::to_string(sender));
+      }
+      unsigned long &last = r.maxDelivered[sender - 1];
+      if (fifo) {
+        if (msg != last + 1) {
+          return fail(r, path, lineNumber,
+                      "Message delivered out of order. Expected message " +
+                          std::to_string(last + 1) +
+                          ", but delivered message " + std::to_string(msg));
+        }
+      } else {
+        auto &s = seen[sender - 1];
+        if (msg >= s.size()) {
+          s.resize(std::max(2 * s.size(), msg + 1), false);
+        }
+        if (s[msg]) {
+          return fail(r, path, lineNumber,
+                      "Message " + std::to_string(msg) + " from " +
+                          std::to_string(sender) + " delivered twice");
+        }
+        s[msg] = true;
+      }
+      last = std::max(last, msg);
+      r.deliveries++;
+    } else {
+      return fail(r, path, lineNumber, "Malformed line");
+    }
+  }
+}
+
+// Integer sets, one per line, sorted; `skipHeader` drops a config first line
+static void readSets(const std::string &path, bool skipHeader,
+                     fileResult &r) {
+  MappedFile f;
+  if (!f.open(path)) {
+    return fail(r, path, 0, "cannot be read");
+  }
+  LineReader in(f);
+  for (bool more = in.first(); more; more = in.nextLine()) {
+    if (skipHeader) {
+      skipHeader = false;
+      continue;
+    }
+    std::vector<unsigned long> set;
+    unsigned long v;
+    while (in.number(v)) {
+      set.push_back(v);
+    }
+    std::sort(set.begin(), set.end());
+    set.erase(std::unique(set.begin(), set.end()), set.end());
+    r.sets.push_back(std::move(set));
+  }
+}
+
+static bool subset(const std::vector<unsigned long> &a,
+                   const std::vector<unsigned long> &b) {
+  return std::includes(b.begin(), b.end(), a.begin(), a.end());
+}
+
+static void usage(const char *argv0) {
+  std::cerr << "Usage: " << argv0
+            << " perfect|fifo|lattice [--config CONFIG]... "
+               "[--duration SECONDS] OUTPUT...\n";
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  Mode mode;
+  if (strcmp(argv[1], "perfect") == 0) {
+    mode = PerfectLinks;
+  } else if (strcmp(argv[1], "fifo") == 0) {
+    mode = FIFOBroadcast;
+  } else if (strcmp(argv[1], "lattice") == 0) {
+    mode = LatticeAgreement;
+  } else {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  std::vector<std::string> configs, outputs;
+  double duration = 0;
+  for (int i = 2; i < argc; i++) {
+    if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      configs.push_back(argv[++i]);
+    } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+      duration = std::stod(argv[++i]);
+    } else {
+      outputs.push_back(argv[i]);
+    }
+  }
+  size_t nbProcs = outputs.size();
+  if (nbProcs == 0 || (mode == PerfectLinks && configs.size() != 1) ||
+      (mode == LatticeAgreement && configs.size() != 1 &&
+       configs.size() != nbProcs)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  // One thread per file (and per lattice config)
+  std::vector<fileResult> results(nbProcs, fileResult{true, "", 0, 0, {}, {}});
+  std::vector<fileResult> proposals(
+      mode == LatticeAgreement ? configs.size() : 0,
+      fileResult{true, "", 0, 0, {}, {}});
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < nbProcs; i++) {
+    workers.emplace_back([&, i]() {
+      if (mode == LatticeAgreement) {
+        readSets(outputs[i], false, results[i]);
+      } else {
+        checkEvents(outputs[i], nbProcs, mode == FIFOBroadcast, results[i]);
+      }
+    });
+  }
+  for (size_t i = 0; i < proposals.size(); i++) {
+    workers.emplace_back(
+        [&, i]() { readSets(configs[i], true, proposals[i]); });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < nbProcs; i++) {
+    std::cout << "Checking " << outputs[i] << "\n";
+    if (!results[i].ok) {
+      std::cout << results[i].error << "\n";
+      ok = false;
+    }
+  }
+  for (auto &p : proposals) {
+    if (!p.ok) {
+      std::cout << p.error << "\n";
+      ok = false;
+    }
+  }
+
+  // Cross-file merge
+  unsigned long deliveries = 0;
+  if (ok && mode != LatticeAgreement) {
+    unsigned long nbMessages = 0, receiver = 0;
+    if (mode == PerfectLinks) {
+      std::ifstream config(configs[0]);
+      config >> nbMessages >> receiver;
+    }
+    for (size_t i = 0; ok && i < nbProcs; i++) {
+      const fileResult &r = results[i];
+      deliveries += r.deliveries;
+      if (mode == PerfectLinks && r.deliveries > 0 && i + 1 != receiver) {
+        std::cout << outputs[i] << ": delivers but is not the receiver\n";
+        ok = false;
+      }
+      if (mode == PerfectLinks && r.broadcasts > nbMessages) {
+        std::cout << outputs[i] << ": sends more than " << nbMessages
+                  << " messages\n";
+        ok = false;
+      }
+      for (size_t s = 0; ok && s < nbProcs; s++) {
+        // No creation: nothing delivered that was not broadcast
+        if (r.maxDelivered[s] > results[s].broadcasts) {
+          std::cout << outputs[i] << ": delivers message "
+                    << r.maxDelivered[s] << " from " << s + 1
+                    << " which only broadcast " << results[s].broadcasts
+                    << "\n";
+          ok = false;
+        }
+      }
+    }
+  } else if (ok) {
+    for (size_t i = 0; ok && i < nbProcs; i++) {
+      const fileResult &props = proposals[proposals.size() == 1 ? 0 : i];
+      deliveries += results[i].sets.size();
+      for (size_t slot = 0; ok && slot < results[i].sets.size(); slot++) {
+        if (slot >= props.sets.size() ||
+            !subset(props.sets[slot], results[i].sets[slot])) {
+          std::cout << outputs[i] << ": slot " << slot + 1
+                    << " decision does not contain the proposal\n";
+          ok = false;
+        }
+      }
+    }
+    // Per slot: decisions within the union of proposals, and totally ordered
+    size_t nbSlots = 0;
+    for (auto &r : results) {
+      nbSlots = std::max(nbSlots, r.sets.size());
+    }
+    for (size_t slot = 0; ok && slot < nbSlots; slot++) {
+      std::vector<unsigned long> all;
+      for (auto &p : proposals) {
+        if (slot < p.sets.size()) {
+          all.insert(all.end(), p.sets[slot].begin(), p.sets[slot].end());
+        }
+      }
+      std::sort(all.begin(), all.end());
+      std::vector<const std::vector<unsigned long> *> decisions;
+      for (auto &r : results) {
+        if (slot < r.sets.size()) {
+          decisions.push_back(&r.sets[slot]);
+        }
+      }
+      std::sort(decisions.begin(), decisions.end(),
+                [](const std::vector<unsigned long> *a,
+                   const std::vector<unsigned long> *b) {
+                  return a->size() < b->size();
+                });
+      for (size_t d = 0; ok && d < decisions.size(); d++) {
+        if (!subset(*decisions[d], all)) {
+          std::cout << "Slot " << slot + 1
+                    << ": decision contains values never proposed\n";
+          ok = false;
+        } else if (d > 0 && !subset(*decisions[d - 1], *decisions[d])) {
+          std::cout << "Slot " << slot + 1 << ": decisions not comparable\n";
+          ok = false;
+        }
+      }
+    }
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << (ok ? "Validation OK" : "Validation failed!") << "\n";
+  std::cout << deliveries << " deliveries";
+  if (duration > 0) {
+    std::cout << " (" << static_cast<double>(deliveries) / duration
+              << " deliveries/s over " << duration << " s)";
+  }
+  std::cout << ", validated in " << elapsed.count() << " s\n";
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}